@@ -11,6 +11,36 @@ function! libclang#version()
     return libcall(g:libclang#lib_path, 'vim_clang_version', '')
 endfunction
 
+function! libclang#set_parse_profile(profile)
+    return eval(libcall(g:libclang#lib_path, 'vim_clang_set_parse_profile', a:profile))
+endfunction
+
+function! libclang#set_preamble_directory(directory)
+    return eval(libcall(g:libclang#lib_path, 'vim_clang_set_preamble_directory', a:directory))
+endfunction
+
+" Keeps the lines of a modified buffer in memory, later calls on file use
+" them instead of the file on disk.
+function! libclang#update_buffer(file, lines)
+    let contents = empty(a:lines) ? '' : join(a:lines, "\n") . "\n"
+    return eval(libcall(g:libclang#lib_path, 'vim_clang_update_buffer', a:file . ':' . contents))
+endfunction
+
+" Replaces the lines first..last of the kept buffer, e.g. from the changes
+" reported by listener_add(). Returns {} if the buffer is not kept yet.
+function! libclang#update_buffer_lines(file, first, last, lines)
+    let text = empty(a:lines) ? '' : join(a:lines, "\n") . "\n"
+    return eval(libcall(g:libclang#lib_path, 'vim_clang_update_buffer_lines', printf("%s:%d:%d:%s", a:file, a:first, a:last, text)))
+endfunction
+
+function! libclang#drop_buffer(file)
+    return eval(libcall(g:libclang#lib_path, 'vim_clang_drop_buffer', a:file))
+endfunction
+
+function! libclang#shutdown()
+    return eval(libcall(g:libclang#lib_path, 'vim_clang_shutdown', ''))
+endfunction
+
 function! s:get_extra_string(extra)
     if len(a:extra) == 1
         if type(a:extra[0]) == s:LIST_TYPE
@@ -25,12 +55,48 @@ function! s:get_extra_string(extra)
     endif
 endfunction
 
-function! libclang#call(api, file, extra)
+" json_decode() is much faster than eval() on large results.
+let s:use_json = exists('*json_decode')
+
+function! s:get_compiler_args(extra)
     let compiler_args = s:get_extra_string(a:extra)
-    return eval(libcall(g:libclang#lib_path, a:api, a:file . ':' . compiler_args))
+    return s:use_json ? compiler_args . ' --vim-clang-format=json' : compiler_args
+endfunction
+
+function! s:decode(result)
+    return s:use_json ? json_decode(a:result) : eval(a:result)
+endfunction
+
+function! libclang#call(api, file, extra)
+    let compiler_args = s:get_compiler_args(a:extra)
+    return s:decode(libcall(g:libclang#lib_path, a:api, a:file . ':' . compiler_args))
 endfunction
 
 function! libclang#call_at(api, file, line, col, extra)
-    let compiler_args = s:get_extra_string(a:extra)
-    return eval(libcall(g:libclang#lib_path, a:api, printf("%s:%s:%d:%d", a:file, compiler_args, a:line, a:col)))
+    let compiler_args = s:get_compiler_args(a:extra)
+    return s:decode(libcall(g:libclang#lib_path, a:api, printf("%s:%s:%d:%d", a:file, compiler_args, a:line, a:col)))
+endfunction
+
+function! libclang#call_on_node(api, file, handle, extra)
+    let compiler_args = s:get_compiler_args(a:extra)
+    return s:decode(libcall(g:libclang#lib_path, a:api, printf("%s:%s:%d", a:file, compiler_args, a:handle)))
+endfunction
+
+function! libclang#call_with_query(api, file, expression, extra)
+    let compiler_args = s:get_compiler_args(a:extra)
+    return s:decode(libcall(g:libclang#lib_path, a:api, printf("%s:%s:%s", a:file, compiler_args, a:expression)))
+endfunction
+
+function! libclang#parse_async(file, ...)
+    return libclang#call('vim_clang_parse_async', a:file, a:000)
+endfunction
+
+function! libclang#poll(ticket)
+    return eval(libcall(g:libclang#lib_path, 'vim_clang_poll', string(a:ticket)))
+endfunction
+
+function! libclang#batch(file, queries, ...)
+    let compiler_args = s:get_compiler_args(a:000)
+    let queries = join(map(copy(a:queries), 'printf("%s:%d:%d", v:val[0], v:val[1], v:val[2])'), ';')
+    return s:decode(libcall(g:libclang#lib_path, 'vim_clang_batch', printf("%s:%s:%s", a:file, compiler_args, queries)))
 endfunction
@@ -0,0 +1,3 @@
+function! libclang#AST#query(filename, expression, ...)
+    return libclang#call_with_query('vim_clang_query', a:filename, a:expression, a:000)
+endfunction
@@ -34,3 +34,6 @@ endfunction
 function! libclang#AST#whole#static_member_functions(filename, ...)
     return libclang#call('vim_clang_extract_static_member_functions', a:filename, a:000)
 endfunction
+function! libclang#AST#whole#children_of(filename, handle, ...)
+    return libclang#call_on_node('vim_clang_children_of', a:filename, a:handle, a:000)
+endfunction
@@ -19,6 +19,12 @@ endfunction
 function! libclang#deduction#completion_at(filename, line, col, ...)
     return libclang#call_at('vim_clang_get_completion_at', a:filename, a:line, a:col, a:000)
 endfunction
+function! libclang#deduction#completion_items_at(filename, line, col, ...)
+    return libclang#call_at('vim_clang_get_completion_items_at', a:filename, a:line, a:col, a:000)
+endfunction
+function! libclang#deduction#completion_detail(session, index)
+    return eval(libcall(g:libclang#lib_path, 'vim_clang_completion_detail', printf("%d:%d", a:session, a:index)))
+endfunction
 function! libclang#deduction#comment_at(filename, line, col, ...)
     return libclang#call_at('vim_clang_get_comment_at', a:filename, a:line, a:col, a:000)
 endfunction
@@ -1,3 +1,11 @@
 function! libclang#tokens#all(file_name, ...)
     return libclang#call('vim_clang_tokens', a:file_name, a:000)
 endfunction
+
+function! libclang#tokens#in_range(file_name, first_line, last_line, ...)
+    return libclang#call_at('vim_clang_tokens_in_range', a:file_name, a:first_line, a:last_line, a:000)
+endfunction
+
+function! libclang#tokens#delta(file_name, ...)
+    return libclang#call('vim_clang_tokens_delta', a:file_name, a:000)
+endfunction
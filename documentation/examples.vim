@@ -14,10 +14,9 @@ endfunction
 
 " Example for libclang#deduction#type_at().
 function! ClangInspectType()
-    let l:compiler_args = libclang#deduction#compile_commands(expand('%:p'))
     let l:temp_file = ClangTempFile()
     let l:file_name = expand('%:p') . '#' . l:temp_file
-    let type_info = libclang#deduction#type_at(l:file_name, line('.'), col('.'), l:compiler_args.commands)
+    let type_info = libclang#deduction#type_at(l:file_name, line('.'), col('.'), '--vim-clang-args=auto')
     call delete(l:temp_file)
     if type_info.type ==# type_info.canonical.type
         echo type_info.type
@@ -29,30 +28,27 @@ endfunction
 
 " Example for libclang#deduction#current_function_at().
 function! ClangInspectFunction()
-    let l:compiler_args = libclang#deduction#compile_commands(expand('%:p'))
     let l:temp_file = ClangTempFile()
     let l:file_name = expand('%:p') . '#' . l:temp_file
-    let l:info = libclang#deduction#current_function_at(l:file_name, line('.'), col('.'), l:compiler_args.commands)
+    let l:info = libclang#deduction#current_function_at(l:file_name, line('.'), col('.'), '--vim-clang-args=auto')
     call delete(l:temp_file)
     echo l:info.name . '()'
 endfunction
 
 " Example for libclang#deduction#full_name_at().
 function! ClangInspectName()
-    let l:compiler_args = libclang#deduction#compile_commands(expand('%:p'))
     let l:temp_file = ClangTempFile()
     let l:file_name = expand('%:p') . '#' . l:temp_file
-    let l:info = libclang#deduction#full_name_at(l:file_name, line('.'), col('.'), l:compiler_args.commands)
+    let l:info = libclang#deduction#full_name_at(l:file_name, line('.'), col('.'), '--vim-clang-args=auto')
     call delete(l:temp_file)
     echo l:info.name
 endfunction
 
 " Example for libclang#deduction#comment_at().
 function! ClangInspectComment()
-    let l:compiler_args = libclang#deduction#compile_commands(expand('%:p'))
     let l:temp_file = ClangTempFile()
     let l:file_name = expand('%:p') . '#' . l:temp_file
-    let l:info = libclang#deduction#comment_at(file_name, line('.'), col('.'), l:compiler_args.commands)
+    let l:info = libclang#deduction#comment_at(file_name, line('.'), col('.'), '--vim-clang-args=auto')
     call delete(l:temp_file)
     echo l:info.brief
 endfunction
@@ -60,10 +56,9 @@ endfunction
 " Example for libclang#deduction#declaration_at().
 " See ':help jumplist', e.g. use Ctrl-O to jump back.
 function! ClangJumpDeclaration()
-    let compiler_args = libclang#deduction#compile_commands(expand('%:p'))
     let temp_file = ClangTempFile()
     let file_name = expand('%:p') . '#' . temp_file
-    let info = libclang#deduction#declaration_at(file_name, line('.'), col('.'), compiler_args.commands)
+    let info = libclang#deduction#declaration_at(file_name, line('.'), col('.'), '--vim-clang-args=auto')
     call delete(temp_file)
 
     if info.file == file_name
@@ -82,10 +77,9 @@ endfunction
 " Example for libclang#deduction#include_at().
 " See ':help jumplist', e.g. use Ctrl-O to jump back.
 function! ClangJumpInclude()
-    let compiler_args = libclang#deduction#compile_commands(expand('%:p'))
     let temp_file = ClangTempFile()
     let file_name = expand('%:p') . '#' . temp_file
-    let info = libclang#deduction#include_at(file_name, line('.'), col('.'), compiler_args.commands)
+    let info = libclang#deduction#include_at(file_name, line('.'), col('.'), '--vim-clang-args=auto')
     call delete(temp_file)
 
     " Add an entry to the jump list.
@@ -97,10 +91,9 @@ endfunction
 sign define ClangError text=EE
 sign define ClangWarning text=WW
 function! ClangShowDiagnostics()
-    let l:compiler_args = libclang#deduction#compile_commands(expand('%:p'))
     let l:temp_file = ClangTempFile()
     let l:file_name = expand('%:p') . '#' . l:temp_file
-    let l:diagnostics = libclang#deduction#diagnostics(l:file_name, l:compiler_args.commands)
+    let l:diagnostics = libclang#deduction#diagnostics(l:file_name, '--vim-clang-args=auto')
     call delete(l:temp_file)
 
     " Delete previous diagnostics.
@@ -138,25 +131,16 @@ function! ClangInspectCompletion(findstart, base)
     let l:l = line('.')
     let l:c = col('.')
 
-    let compiler_args = libclang#deduction#compile_commands(expand('%:p'))
-
     let l:temp_file = ClangTempFile()
     let l:file_name = expand('%:p') . '#' . l:temp_file
-    let l:matches = libclang#deduction#completion_at(l:file_name, line('.'), col('.'), compiler_args.commands)
-    call delete(l:temp_file)
-
-    " Filter out matches that do not match the prefix we got.
-    let l:ret = l:matches
+    " The library filters and ranks the matches by the prefix we got.
+    let l:args = '--vim-clang-args=auto --vim-clang-limit=50'
     if a:base != ""
-        let l:ret = []
-        for l:match in l:matches
-            if l:match[:strlen(a:base)-1] == a:base
-                let l:ret = l:ret + [l:match]
-            endif
-        endfor
+        let l:args .= ' --vim-clang-prefix=' . a:base
     endif
-
-    return l:ret
+    let l:matches = libclang#deduction#completion_at(l:file_name, l:l, l:c, l:args)
+    call delete(l:temp_file)
+    return l:matches
 endfunction
 
 " vim:set shiftwidth=4 softtabstop=4 expandtab:
@@ -1,77 +1,279 @@
 #include "AST_extracter.hpp"
+#include "result_arena.hpp"
+#include "translation_unit_cache.hpp"
+
+#include <cstdlib>
+#include <vector>
 
 namespace {
 
-enum { result = 0, visit_policy, predicate };
+/// State of one extraction, shared by the recursive visits.
+class callback_data_type {
+  public:
+    libclang_vim::vimson_writer& writer;
+    libclang_vim::extraction_policy const policy;
+    const std::function<bool(const CXCursor&)>& predicate;
+    const std::function<bool(const CXCursor&)>& descend;
 
-using callback_data_type =
-    std::tuple<std::string&, libclang_vim::extraction_policy const,
-               const std::function<bool(const CXCursor&)>&>;
+    /// Limits, 0 means no limit.
+    unsigned long max_depth = 0;
+    unsigned long max_nodes = 0;
+    /// Id of the first node to write, to continue a previous extraction.
+    unsigned long start = 0;
+    /// Write the ids of the nodes, needed to put pages together.
+    bool write_ids = false;
+    /// See libclang_vim::cursor_field.
+    unsigned fields = libclang_vim::all_cursor_fields;
+    libclang_vim::token_index* tokens = nullptr;
 
-CXChildVisitResult AST_extracter(CXCursor cursor, CXCursor parent,
-                                 CXClientData data) {
-    auto& callback_data = *reinterpret_cast<callback_data_type*>(data);
-    auto& vimson = std::get<result>(callback_data);
-    auto& policy = std::get<visit_policy>(callback_data);
+    /// Ids are given to the target nodes in visiting order.
+    unsigned long next_id = 0;
+    unsigned long written_nodes = 0;
+    /// Ids of the target nodes around the current one.
+    std::vector<unsigned long> parent_ids;
+    /// Number of written nodes around the current one.
+    std::size_t open_nodes = 0;
+    /// Set when max_nodes is reached, next_id is then the continuation.
+    bool stopped = false;
 
+    callback_data_type(libclang_vim::vimson_writer& w,
+                       libclang_vim::extraction_policy p,
+                       const std::function<bool(const CXCursor&)>& pred,
+                       const std::function<bool(const CXCursor&)>& desc)
+        : writer(w), policy(p), predicate(pred), descend(desc) {}
+};
+
+/// Returns true if policy leaves out cursor and its children.
+bool is_excluded(CXCursor const& cursor,
+                 libclang_vim::extraction_policy policy) {
     if (policy == libclang_vim::extraction_policy::current_file) {
         auto const location = clang_getCursorLocation(cursor);
         if (!clang_Location_isFromMainFile(location)) {
-            return CXChildVisit_Continue;
+            return true;
         }
     }
 
     if (policy == libclang_vim::extraction_policy::non_system_headers) {
         auto const location = clang_getCursorLocation(cursor);
         if (clang_Location_isInSystemHeader(location)) {
-            return CXChildVisit_Continue;
+            return true;
         }
     }
 
-    bool const is_target_node = std::get<predicate>(callback_data)(cursor);
-    if (is_target_node) {
-        vimson += "{" + libclang_vim::stringize_cursor(cursor, parent) +
-                  "'children':[";
+    return false;
+}
+
+CXChildVisitResult has_children_visitor(CXCursor, CXCursor, CXClientData data) {
+    *reinterpret_cast<bool*>(data) = true;
+    return CXChildVisit_Break;
+}
+
+bool has_children(CXCursor const& cursor) {
+    bool result = false;
+    clang_visitChildren(cursor, has_children_visitor, &result);
+    return result;
+}
+
+CXChildVisitResult AST_extracter(CXCursor cursor, CXCursor parent,
+                                 CXClientData data) {
+    auto& callback_data = *reinterpret_cast<callback_data_type*>(data);
+    auto& writer = callback_data.writer;
+
+    if (is_excluded(cursor, callback_data.policy))
+        return CXChildVisit_Continue;
+
+    bool const descend = callback_data.descend(cursor);
+    if (!callback_data.predicate(cursor)) {
+        // libclang visits the children, with this node as their parent.
+        return descend ? CXChildVisit_Recurse : CXChildVisit_Continue;
+    }
+
+    if (callback_data.max_nodes != 0 &&
+        callback_data.written_nodes == callback_data.max_nodes) {
+        callback_data.stopped = true;
+        return CXChildVisit_Break;
+    }
+
+    unsigned long const id = callback_data.next_id++;
+    bool const is_written = id >= callback_data.start;
+    if (is_written) {
+        ++callback_data.written_nodes;
+        writer.append('{');
+        libclang_vim::stringize_cursor(writer, cursor, parent,
+                                       callback_data.fields,
+                                       callback_data.tokens);
+        if (callback_data.write_ids) {
+            writer.append("'id':").append_number(id).append(',');
+            // The parent is on a previous page.
+            if (callback_data.open_nodes == 0 &&
+                !callback_data.parent_ids.empty()) {
+                writer.append("'parent_id':")
+                    .append_number(callback_data.parent_ids.back())
+                    .append(',');
+            }
+        }
     }
 
+    bool const too_deep =
+        callback_data.max_depth != 0 &&
+        callback_data.parent_ids.size() + 1 >= callback_data.max_depth;
+    if (!descend || too_deep) {
+        // The caller can extract the children of a too deep node separately.
+        if (is_written) {
+            if (descend && has_children(cursor))
+                writer.append("'has_children':1,");
+            writer.append("'children':[]},");
+        }
+        return CXChildVisit_Continue;
+    }
+
+    if (is_written) {
+        writer.append("'children':[");
+        ++callback_data.open_nodes;
+    }
+    callback_data.parent_ids.push_back(id);
+
     // visit children recursively
     clang_visitChildren(cursor, AST_extracter, data);
 
-    if (is_target_node) {
-        vimson += "]},";
+    callback_data.parent_ids.pop_back();
+    if (is_written) {
+        writer.append("]},");
+        --callback_data.open_nodes;
     }
 
+    return callback_data.stopped ? CXChildVisit_Break : CXChildVisit_Continue;
+}
+
+using children_data_type =
+    std::tuple<libclang_vim::vimson_writer&, libclang_vim::extraction_policy,
+               libclang_vim::translation_unit_data&, unsigned>;
+
+CXChildVisitResult children_extracter(CXCursor cursor, CXCursor parent,
+                                      CXClientData data) {
+    auto& children_data = *reinterpret_cast<children_data_type*>(data);
+    auto& writer = std::get<0>(children_data);
+
+    if (is_excluded(cursor, std::get<1>(children_data)))
+        return CXChildVisit_Continue;
+
+    writer.append('{');
+    libclang_vim::stringize_cursor(writer, cursor, parent,
+                                   std::get<3>(children_data),
+                                   &std::get<2>(children_data).tokens);
+    writer.append("'handle':")
+        .append_number(std::get<2>(children_data).handles.add(cursor))
+        .append(',');
+    if (has_children(cursor))
+        writer.append("'has_children':1,");
+    writer.append("},");
+
+    // Only one level.
     return CXChildVisit_Continue;
 }
+
+/// Parse options for policy, the same for all calls with the same policy, so
+/// that they get the same cached translation unit.
+unsigned get_extraction_options(const libclang_vim::location_tuple& parsed,
+                                libclang_vim::extraction_policy policy) {
+    unsigned options = libclang_vim::get_parse_options(parsed);
+    if (policy != libclang_vim::extraction_policy::current_file) {
+        // Declarations from a precompiled preamble are not visited, but here
+        // the included files are wanted as well.
+        options &= ~libclang_vim::preamble_options;
+    }
+    return options;
+}
 }
 
 const char* libclang_vim::extract_AST_nodes(
     char const* arguments, extraction_policy const policy,
-    const std::function<bool(const CXCursor&)>& predicate) {
-    static std::string vimson;
-    vimson = "";
-
-    auto const parsed = parse_default_args(arguments);
-    auto const args_ptrs = get_args_ptrs(parsed.args);
-
-    callback_data_type callback_data{vimson, policy, predicate};
-
-    cxindex_ptr index =
-        clang_createIndex(/*excludeDeclsFromPCH*/ 1, /*displayDiagnostics*/ 0);
-    std::vector<CXUnsavedFile> unsaved_files = create_unsaved_files(parsed);
-    cxtranslation_unit_ptr translation_unit(clang_parseTranslationUnit(
-        index, parsed.file.c_str(), args_ptrs.data(), args_ptrs.size(),
-        unsaved_files.data(), unsaved_files.size(),
-        CXTranslationUnit_Incomplete));
+    const std::function<bool(const CXCursor&)>& predicate,
+    const std::function<bool(const CXCursor&)>& descend) {
+    return extract_AST_nodes(parse_default_args(arguments), policy, predicate,
+                             descend);
+}
+
+const char* libclang_vim::extract_AST_nodes(
+    const location_tuple& parsed, extraction_policy const policy,
+    const std::function<bool(const CXCursor&)>& predicate,
+    const std::function<bool(const CXCursor&)>& descend) {
+    locked_translation_unit translation_unit =
+        parse_translation_unit(parsed, get_extraction_options(parsed, policy));
     if (!translation_unit)
         return "{}";
 
+    vimson_writer writer;
+    // File names and kinds repeat in nearly every node, with
+    // --vim-clang-intern=1 the nodes refer to them by ids.
+    symbol_table files;
+    symbol_table kinds;
+    bool const intern = get_option(parsed, "intern") == "1";
+    if (intern)
+        writer.intern(&files, &kinds);
+    writer.append("{'root':[");
+
+    callback_data_type callback_data(writer, policy, predicate, descend);
+    callback_data.max_depth =
+        std::strtoul(get_option(parsed, "max-depth").c_str(), nullptr, 10);
+    callback_data.max_nodes =
+        std::strtoul(get_option(parsed, "max-nodes").c_str(), nullptr, 10);
+    callback_data.start =
+        std::strtoul(get_option(parsed, "start").c_str(), nullptr, 10);
+    callback_data.write_ids =
+        callback_data.max_nodes != 0 || callback_data.start != 0;
+    callback_data.fields = get_cursor_fields(parsed);
+    callback_data.tokens = &translation_unit.data().tokens;
     CXCursor cursor = clang_getTranslationUnitCursor(translation_unit);
     clang_visitChildren(cursor, AST_extracter, &callback_data);
 
-    vimson = "{'root':[" + vimson + "]}";
+    writer.append(']');
+    if (callback_data.stopped) {
+        // Passing this as --vim-clang-start continues the extraction.
+        writer.append(",'next':").append_number(callback_data.next_id);
+    }
+    if (intern) {
+        writer.append(",'files':");
+        files.write(writer);
+        writer.append(",'kinds':");
+        kinds.write(writer);
+    }
+    writer.append('}');
+
+    return store_result(writer.release(), parsed);
+}
+
+const char* libclang_vim::extract_AST_children(const location_tuple& parsed,
+                                               extraction_policy const policy,
+                                               unsigned long handle) {
+    locked_translation_unit translation_unit =
+        parse_translation_unit(parsed, get_extraction_options(parsed, policy));
+    if (!translation_unit)
+        return "{}";
+
+    CXCursor cursor = clang_getTranslationUnitCursor(translation_unit);
+    if (handle != 0 && !translation_unit.data().handles.get(handle, cursor))
+        return "{}";
+
+    vimson_writer writer;
+    writer.append("{'children':[");
+    children_data_type children_data{writer, policy, translation_unit.data(),
+                                     get_cursor_fields(parsed)};
+    clang_visitChildren(cursor, children_extracter, &children_data);
+    writer.append("]}");
+
+    return store_result(writer.release(), parsed);
+}
+
+bool libclang_vim::always_descend(const CXCursor&) { return true; }
+
+bool libclang_vim::never_descend(const CXCursor&) { return false; }
 
-    return vimson.c_str();
+bool libclang_vim::may_contain_member_functions(const CXCursor& cursor) {
+    CXCursorKind const kind = clang_getCursorKind(cursor);
+    // Expressions are not skipped: a lambda or a GNU statement expression with
+    // local classes may be nested in any of them, e.g. in a call argument.
+    return !clang_isReference(kind) && !clang_isAttribute(kind);
 }
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -11,15 +11,40 @@
 
 namespace libclang_vim {
 
+bool always_descend(const CXCursor& cursor);
+
+/// For nodes which are only found at the top level, like preprocessing ones.
+bool never_descend(const CXCursor& cursor);
+
+/// Skips references and attributes, which can't have member functions.
+bool may_contain_member_functions(const CXCursor& cursor);
+
 enum struct extraction_policy {
     all = 0,
     non_system_headers,
     current_file,
 };
 
+/// Extracts the nodes for which predicate is true. The children of a node
+/// are only visited if descend is true for it, so that subtrees which can't
+/// have matching nodes are skipped.
 const char*
 extract_AST_nodes(char const* arguments, extraction_policy policy,
-                  const std::function<bool(const CXCursor&)>& predicate);
+                  const std::function<bool(const CXCursor&)>& predicate,
+                  const std::function<bool(const CXCursor&)>& descend =
+                      always_descend);
+
+const char*
+extract_AST_nodes(const location_tuple& parsed, extraction_policy policy,
+                  const std::function<bool(const CXCursor&)>& predicate,
+                  const std::function<bool(const CXCursor&)>& descend);
+
+/// Extracts the direct children of the node with the given handle, 0 means
+/// the translation unit. The children get handles of their own, valid till
+/// the file changes.
+const char* extract_AST_children(const location_tuple& parsed,
+                                 extraction_policy policy,
+                                 unsigned long handle);
 
 } // namespace libclang_vim
 
@@ -1,42 +1,371 @@
+#include <dlfcn.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <string>
 #include <tuple>
 
 #include <clang-c/Index.h>
 
 #include "helpers.hpp"
+#include "compilation_database.hpp"
+#include "completion.hpp"
 #include "tokenizer.hpp"
 #include "AST_extracter.hpp"
 #include "location.hpp"
 #include "deduction.hpp"
-
-/// Ensures that writes to stderr are ignored.
+#include "parse_queue.hpp"
+#include "query.hpp"
+#include "result_arena.hpp"
+#include "translation_unit_cache.hpp"
+#include "unsaved_buffers.hpp"
+#include "vimson_writer.hpp"
+
+/// Ensures that writes to stderr are ignored. Guards may be alive on several
+/// threads at the same time, stderr is restored when the last one goes away.
 class stderr_guard {
-    int m_stderr;
+    static std::mutex s_mutex;
+    static int s_count;
+    static int s_stderr;
 
   public:
-    stderr_guard() : m_stderr(dup(STDERR_FILENO)) {
-        // Close stderr.
-        close(STDERR_FILENO);
+    stderr_guard() {
+        std::lock_guard<std::mutex> lock(s_mutex);
+        if (s_count++ > 0)
+            return;
+
+        // Redirect stderr to /dev/null, so its file descriptor is not reused.
+        s_stderr = dup(STDERR_FILENO);
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0) {
+            dup2(null, STDERR_FILENO);
+            close(null);
+        }
     }
 
     ~stderr_guard() {
+        std::lock_guard<std::mutex> lock(s_mutex);
+        if (--s_count > 0)
+            return;
+
         // Restore stderr.
-        dup(m_stderr);
-        close(m_stderr);
+        if (s_stderr >= 0) {
+            dup2(s_stderr, STDERR_FILENO);
+            close(s_stderr);
+        }
     }
 };
 
+std::mutex stderr_guard::s_mutex;
+int stderr_guard::s_count = 0;
+int stderr_guard::s_stderr = -1;
+
+namespace {
+
+/// Vim's libcall() may unload the library after each call, which would throw
+/// away the caches. Opening it again with RTLD_NODELETE keeps it loaded till
+/// the process exits, vim_clang_shutdown() releases the caches instead.
+bool pin_library() {
+    static const char anchor = 0;
+    Dl_info info;
+    if (dladdr(&anchor, &info) == 0 || !info.dli_fname)
+        return false;
+
+    return dlopen(info.dli_fname, RTLD_NOW | RTLD_NOLOAD | RTLD_NODELETE) !=
+           nullptr;
+}
+
+const bool pinned = pin_library();
+
+using location_query = std::function<std::string(
+    CXTranslationUnit, const libclang_vim::location_tuple&)>;
+
+std::string
+get_location_information(CXTranslationUnit translation_unit,
+                         const libclang_vim::location_tuple& location_info) {
+    unsigned const fields = libclang_vim::get_cursor_fields(location_info);
+    return libclang_vim::at_specific_location(
+        translation_unit, location_info, [fields](CXCursor const& cursor) {
+            return "{" +
+                   libclang_vim::stringize_cursor(
+                       cursor, clang_getCursorSemanticParent(cursor), fields) +
+                   "}";
+        });
+}
+
+std::string
+get_extent_of_node(CXTranslationUnit translation_unit,
+                   const libclang_vim::location_tuple& location_info) {
+    return libclang_vim::at_specific_location(
+        translation_unit, location_info, [](CXCursor const& cursor) {
+            return "{" + libclang_vim::stringize_extent(cursor) + "}";
+        });
+}
+
+unsigned is_expression(CXCursor cursor) {
+    return clang_isExpression(clang_getCursorKind(cursor));
+}
+
+unsigned is_statement(CXCursor cursor) {
+    return clang_isStatement(clang_getCursorKind(cursor));
+}
+
+unsigned is_namespace(CXCursor cursor) {
+    return clang_getCursorKind(cursor) == CXCursor_Namespace;
+}
+
+/// Picks the overload of an API which works on a parsed translation unit.
+location_query unit_query(std::string (*query)(
+    CXTranslationUnit, const libclang_vim::location_tuple&)) {
+    return query;
+}
+
+location_query extent_query(std::function<unsigned(CXCursor)> predicate) {
+    return [predicate](CXTranslationUnit translation_unit,
+                       const libclang_vim::location_tuple& location_info) {
+        return libclang_vim::get_extent(translation_unit, location_info,
+                                        predicate);
+    };
+}
+
+location_query related_node_query(std::function<CXCursor(CXCursor)> predicate) {
+    return [predicate](CXTranslationUnit translation_unit,
+                       const libclang_vim::location_tuple& location_info) {
+        return libclang_vim::get_related_node_of(translation_unit,
+                                                 location_info, predicate);
+    };
+}
+
+location_query related_type_query(std::function<CXType(CXType)> predicate) {
+    return [predicate](CXTranslationUnit translation_unit,
+                       const libclang_vim::location_tuple& location_info) {
+        return libclang_vim::get_type_related_to(translation_unit,
+                                                 location_info, predicate);
+    };
+}
+
+/// Location APIs which vim_clang_batch() can answer, by their exported name.
+const std::map<std::string, location_query>& get_location_queries() {
+    static const std::map<std::string, location_query> queries{
+        {"vim_clang_get_location_information",
+         unit_query(get_location_information)},
+        {"vim_clang_get_extent_of_node_at_specific_location",
+         unit_query(get_extent_of_node)},
+        {"vim_clang_get_inner_definition_extent_at_specific_location",
+         extent_query(clang_isCursorDefinition)},
+        {"vim_clang_get_expression_extent_at_specific_location",
+         extent_query(is_expression)},
+        {"vim_clang_get_statement_extent_at_specific_location",
+         extent_query(is_statement)},
+        {"vim_clang_get_class_extent_at_specific_location",
+         extent_query(libclang_vim::is_class_decl)},
+        {"vim_clang_get_function_extent_at_specific_location",
+         extent_query(libclang_vim::is_function_decl)},
+        {"vim_clang_get_parameter_extent_at_specific_location",
+         extent_query(libclang_vim::is_parameter)},
+        {"vim_clang_get_namespace_extent_at_specific_location",
+         extent_query(is_namespace)},
+        {"vim_clang_get_definition_at",
+         related_node_query(clang_getCursorDefinition)},
+        {"vim_clang_get_referenced_at",
+         related_node_query(clang_getCursorReferenced)},
+        {"vim_clang_get_declaration_at",
+         related_node_query(clang_getCanonicalCursor)},
+        {"vim_clang_get_pointee_type_at",
+         related_type_query(clang_getPointeeType)},
+        {"vim_clang_get_canonical_type_at",
+         related_type_query(clang_getCanonicalType)},
+        {"vim_clang_get_result_type_at",
+         related_type_query(clang_getResultType)},
+        {"vim_clang_get_class_type_of_member_pointer_at",
+         related_type_query(clang_Type_getClassType)},
+        {"vim_clang_get_all_extents_at",
+         unit_query(libclang_vim::get_all_extents)},
+        {"vim_clang_deduce_var_decl_at",
+         unit_query(libclang_vim::deduce_var_decl_type)},
+        {"vim_clang_deduce_func_decl_at",
+         unit_query(libclang_vim::deduce_func_return_type)},
+        {"vim_clang_deduce_func_or_var_decl_at",
+         unit_query(libclang_vim::deduce_func_or_var_decl)},
+        {"vim_clang_get_type_with_deduction_at",
+         unit_query(libclang_vim::deduce_type_at)},
+        {"vim_clang_get_current_function_at",
+         unit_query(libclang_vim::get_current_function_at)},
+        {"vim_clang_get_full_name_at",
+         unit_query(libclang_vim::get_full_name_at)},
+        {"vim_clang_get_completion_at",
+         unit_query(libclang_vim::get_completion_at)},
+        {"vim_clang_get_completion_items_at",
+         unit_query(libclang_vim::get_completion_items_at)},
+        {"vim_clang_get_comment_at", unit_query(libclang_vim::get_comment_at)},
+        {"vim_clang_get_deduced_declaration_at",
+         unit_query(libclang_vim::get_deduced_declaration_at)},
+        {"vim_clang_get_diagnostics",
+         unit_query(libclang_vim::get_diagnostics)},
+    };
+    return queries;
+}
+
+/// Parses "file:args:handle".
+libclang_vim::location_tuple
+parse_args_with_handle(const std::string& arguments, unsigned long& handle) {
+    auto const colon = arguments.rfind(':');
+    if (colon == std::string::npos) {
+        handle = 0;
+        return libclang_vim::parse_default_args(arguments);
+    }
+
+    handle = std::strtoul(arguments.c_str() + colon + 1, nullptr, 10);
+    return libclang_vim::parse_default_args(arguments.substr(0, colon));
+}
+
+char const* extract_AST_children(char const* arguments,
+                                 libclang_vim::extraction_policy policy) {
+    unsigned long handle = 0;
+    auto const parsed = parse_args_with_handle(arguments, handle);
+    return libclang_vim::extract_AST_children(parsed, policy, handle);
+}
+}
+
 extern "C" {
 
 char const* vim_clang_version() {
     return clang_getCString(clang_getClangVersion());
 }
 
+char const* vim_clang_retain_results(char const* retain) {
+    auto& arena = libclang_vim::result_arena::current();
+    arena.set_retain(std::strcmp(retain, "1") == 0);
+    return arena.get_retain() ? "{'retain':1}" : "{'retain':0}";
+}
+
+char const* vim_clang_free_result(char const* result) {
+    libclang_vim::result_arena::free(result);
+    return "";
+}
+
+char const* vim_clang_shutdown(char const* /*unused*/) {
+    libclang_vim::parse_queue::instance().stop();
+    libclang_vim::translation_unit_cache::instance().clear();
+    libclang_vim::clear_token_snapshots();
+    libclang_vim::unsaved_buffers::instance().clear();
+    libclang_vim::compilation_database_cache::instance().clear();
+    libclang_vim::completion_sessions::instance().clear();
+    return libclang_vim::store_result(std::string("{'pinned':") +
+                                      (pinned ? "1" : "0") + "}");
+}
+
+char const* vim_clang_set_parse_profile(char const* name) {
+    libclang_vim::parse_profile profile;
+    if (libclang_vim::parse_profile_from_name(name, profile))
+        libclang_vim::set_default_parse_profile(profile);
+
+    return libclang_vim::store_result(
+        std::string("{'profile':'") +
+        libclang_vim::get_parse_profile_name(
+            libclang_vim::get_default_parse_profile()) +
+        "'}");
+}
+
+char const* vim_clang_set_preamble_directory(char const* directory) {
+    if (!libclang_vim::translation_unit_cache::instance()
+             .set_preamble_directory(directory))
+        return "{}";
+
+    libclang_vim::vimson_writer writer;
+    writer.append("{'directory':'").append_escaped(directory).append("'}");
+    return libclang_vim::store_result(writer.release());
+}
+
+char const* vim_clang_parse_async(char const* arguments) {
+    return libclang_vim::store_result(
+        std::to_string(libclang_vim::parse_queue::instance().enqueue(
+            libclang_vim::parse_default_args(arguments))));
+}
+
+char const* vim_clang_poll(char const* ticket) {
+    libclang_vim::parse_queue::status status;
+    if (!libclang_vim::parse_queue::instance().poll(
+            std::strtoul(ticket, nullptr, 10), status))
+        return "{}";
+
+    switch (status) {
+    case libclang_vim::parse_queue::status::pending:
+        return "'pending'";
+    case libclang_vim::parse_queue::status::ready:
+        return "{'status':'ready'}";
+    case libclang_vim::parse_queue::status::failed:
+        return "{'status':'failed'}";
+    }
+    return "{}";
+}
+
+char const* vim_clang_update_buffer(char const* arguments) {
+    // "file:contents", the contents may contain colons.
+    char const* const colon = std::strchr(arguments, ':');
+    if (!colon)
+        return "{}";
+
+    std::size_t const size = libclang_vim::unsaved_buffers::instance().update(
+        libclang_vim::get_absolute_path({arguments, colon}),
+        std::vector<char>(colon + 1, colon + std::strlen(colon)));
+    return libclang_vim::store_result("{'size':" + std::to_string(size) +
+                                      "}");
+}
+
+char const* vim_clang_update_buffer_lines(char const* arguments) {
+    // "file:first line:last line:text"
+    char const* const colon = std::strchr(arguments, ':');
+    if (!colon)
+        return "{}";
+
+    char* end = nullptr;
+    std::size_t const first_line = std::strtoul(colon + 1, &end, 10);
+    if (*end != ':')
+        return "{}";
+    std::size_t const last_line = std::strtoul(end + 1, &end, 10);
+    if (*end != ':')
+        return "{}";
+
+    std::size_t size = 0;
+    if (!libclang_vim::unsaved_buffers::instance().update_lines(
+            libclang_vim::get_absolute_path({arguments, colon}), first_line,
+            last_line, end + 1, size))
+        return "{}";
+
+    return libclang_vim::store_result("{'size':" + std::to_string(size) +
+                                      "}");
+}
+
+char const* vim_clang_drop_buffer(char const* file) {
+    libclang_vim::unsaved_buffers::instance().remove(
+        libclang_vim::get_absolute_path(file));
+    return "{}";
+}
+
 char const* vim_clang_tokens(char const* arguments) {
     auto const parsed = libclang_vim::parse_default_args(arguments);
     libclang_vim::tokenizer tokenizer{};
-    static auto const vimson = tokenizer.tokenize_as_vimson(parsed);
-    return vimson.c_str();
+    return libclang_vim::store_result(tokenizer.tokenize_as_vimson(parsed),
+                                      parsed);
+}
+
+char const* vim_clang_tokens_in_range(char const* range_string) {
+    // "file:args:first line:last line"
+    auto const parsed = libclang_vim::parse_args_with_location(range_string);
+    libclang_vim::tokenizer tokenizer{};
+    return libclang_vim::store_result(
+        tokenizer.tokenize_lines_as_vimson(parsed, parsed.line, parsed.col),
+        parsed);
+}
+
+char const* vim_clang_tokens_delta(char const* arguments) {
+    auto const parsed = libclang_vim::parse_default_args(arguments);
+    libclang_vim::tokenizer tokenizer{};
+    return libclang_vim::store_result(
+        tokenizer.tokenize_changes_as_vimson(parsed), parsed);
 }
 
 // API to extract AST nodes {{{
@@ -72,7 +401,8 @@ char const* vim_clang_extract_preprocessings(char const* arguments) {
     return libclang_vim::extract_AST_nodes(
         arguments, libclang_vim::extraction_policy::all, [](CXCursor const& c) {
             return clang_isPreprocessing(clang_getCursorKind(c));
-        });
+        },
+        libclang_vim::never_descend);
 }
 
 char const* vim_clang_extract_references(char const* arguments) {
@@ -93,7 +423,8 @@ char const* vim_clang_extract_translation_units(char const* arguments) {
     return libclang_vim::extract_AST_nodes(
         arguments, libclang_vim::extraction_policy::all, [](CXCursor const& c) {
             return clang_isTranslationUnit(clang_getCursorKind(c));
-        });
+        },
+        libclang_vim::never_descend);
 }
 
 char const* vim_clang_extract_definitions(char const* arguments) {
@@ -105,20 +436,23 @@ char const* vim_clang_extract_definitions(char const* arguments) {
 char const* vim_clang_extract_virtual_member_functions(char const* arguments) {
     return libclang_vim::extract_AST_nodes(
         arguments, libclang_vim::extraction_policy::all,
-        [](CXCursor const& c) { return clang_CXXMethod_isVirtual(c); });
+        [](CXCursor const& c) { return clang_CXXMethod_isVirtual(c); },
+        libclang_vim::may_contain_member_functions);
 }
 
 char const*
 vim_clang_extract_pure_virtual_member_functions(char const* arguments) {
     return libclang_vim::extract_AST_nodes(
         arguments, libclang_vim::extraction_policy::all,
-        [](CXCursor const& c) { return clang_CXXMethod_isPureVirtual(c); });
+        [](CXCursor const& c) { return clang_CXXMethod_isPureVirtual(c); },
+        libclang_vim::may_contain_member_functions);
 }
 
 char const* vim_clang_extract_static_member_functions(char const* arguments) {
     return libclang_vim::extract_AST_nodes(
         arguments, libclang_vim::extraction_policy::all,
-        [](CXCursor const& c) { return clang_CXXMethod_isStatic(c); });
+        [](CXCursor const& c) { return clang_CXXMethod_isStatic(c); },
+        libclang_vim::may_contain_member_functions);
 }
 // }}}
 
@@ -159,7 +493,8 @@ vim_clang_extract_preprocessings_current_file(char const* arguments) {
         arguments, libclang_vim::extraction_policy::current_file,
         [](CXCursor const& c) {
             return clang_isPreprocessing(clang_getCursorKind(c));
-        });
+        },
+        libclang_vim::never_descend);
 }
 
 char const* vim_clang_extract_references_current_file(char const* arguments) {
@@ -184,7 +519,8 @@ vim_clang_extract_translation_units_current_file(char const* arguments) {
         arguments, libclang_vim::extraction_policy::current_file,
         [](CXCursor const& c) {
             return clang_isTranslationUnit(clang_getCursorKind(c));
-        });
+        },
+        libclang_vim::never_descend);
 }
 
 char const* vim_clang_extract_definitions_current_file(char const* arguments) {
@@ -197,21 +533,24 @@ char const*
 vim_clang_extract_virtual_member_functions_current_file(char const* arguments) {
     return libclang_vim::extract_AST_nodes(
         arguments, libclang_vim::extraction_policy::current_file,
-        clang_CXXMethod_isVirtual);
+        clang_CXXMethod_isVirtual,
+        libclang_vim::may_contain_member_functions);
 }
 
 char const* vim_clang_extract_pure_virtual_member_functions_current_file(
     char const* arguments) {
     return libclang_vim::extract_AST_nodes(
         arguments, libclang_vim::extraction_policy::current_file,
-        clang_CXXMethod_isPureVirtual);
+        clang_CXXMethod_isPureVirtual,
+        libclang_vim::may_contain_member_functions);
 }
 
 char const*
 vim_clang_extract_static_member_functions_current_file(char const* arguments) {
     return libclang_vim::extract_AST_nodes(
         arguments, libclang_vim::extraction_policy::current_file,
-        clang_CXXMethod_isStatic);
+        clang_CXXMethod_isStatic,
+        libclang_vim::may_contain_member_functions);
 }
 // }}}
 
@@ -255,7 +594,8 @@ vim_clang_extract_preprocessings_non_system_headers(char const* arguments) {
         arguments, libclang_vim::extraction_policy::non_system_headers,
         [](CXCursor const& c) {
             return clang_isPreprocessing(clang_getCursorKind(c));
-        });
+        },
+        libclang_vim::never_descend);
 }
 
 char const*
@@ -282,7 +622,8 @@ vim_clang_extract_translation_units_non_system_headers(char const* arguments) {
         arguments, libclang_vim::extraction_policy::non_system_headers,
         [](CXCursor const& c) {
             return clang_isTranslationUnit(clang_getCursorKind(c));
-        });
+        },
+        libclang_vim::never_descend);
 }
 
 char const*
@@ -296,21 +637,52 @@ char const* vim_clang_extract_virtual_member_functions_non_system_headers(
     char const* arguments) {
     return libclang_vim::extract_AST_nodes(
         arguments, libclang_vim::extraction_policy::non_system_headers,
-        clang_CXXMethod_isVirtual);
+        clang_CXXMethod_isVirtual, libclang_vim::may_contain_member_functions);
 }
 
 char const* vim_clang_extract_pure_virtual_member_functions_non_system_headers(
     char const* arguments) {
     return libclang_vim::extract_AST_nodes(
         arguments, libclang_vim::extraction_policy::non_system_headers,
-        clang_CXXMethod_isPureVirtual);
+        clang_CXXMethod_isPureVirtual,
+        libclang_vim::may_contain_member_functions);
 }
 
 char const* vim_clang_extract_static_member_functions_non_system_headers(
     char const* arguments) {
     return libclang_vim::extract_AST_nodes(
         arguments, libclang_vim::extraction_policy::non_system_headers,
-        clang_CXXMethod_isStatic);
+        clang_CXXMethod_isStatic, libclang_vim::may_contain_member_functions);
+}
+// }}}
+
+// API to extract the nodes matching a filter expression {{{
+char const* vim_clang_query(char const* arguments) {
+    std::string expression;
+    auto const parsed = libclang_vim::parse_query_args(arguments, expression);
+    libclang_vim::query_filter filter;
+    if (parsed.file.empty() || !libclang_vim::compile_query(expression, filter))
+        return "{}";
+
+    return libclang_vim::extract_AST_nodes(parsed, filter.policy,
+                                           filter.predicate, filter.descend);
+}
+// }}}
+
+// API to extract the children of one node {{{
+char const* vim_clang_children_of(char const* arguments) {
+    return extract_AST_children(arguments,
+                                libclang_vim::extraction_policy::all);
+}
+
+char const* vim_clang_children_of_current_file(char const* arguments) {
+    return extract_AST_children(arguments,
+                                libclang_vim::extraction_policy::current_file);
+}
+
+char const* vim_clang_children_of_non_system_headers(char const* arguments) {
+    return extract_AST_children(
+        arguments, libclang_vim::extraction_policy::non_system_headers);
 }
 // }}}
 // }}}
@@ -319,60 +691,22 @@ char const* vim_clang_extract_static_member_functions_non_system_headers(
 char const* vim_clang_get_location_information(char const* location_string) {
     auto const location_info =
         libclang_vim::parse_args_with_location(location_string);
-    char const* file_name = location_info.file.c_str();
-    auto const args_ptrs = libclang_vim::get_args_ptrs(location_info.args);
-    libclang_vim::cxindex_ptr index =
-        clang_createIndex(/*excludeDeclsFromPCH*/ 1, /*displayDiagnostics*/ 0);
-    std::vector<CXUnsavedFile> unsaved_files =
-        create_unsaved_files(location_info);
-    libclang_vim::cxtranslation_unit_ptr translation_unit(
-        clang_parseTranslationUnit(index, file_name, args_ptrs.data(),
-                                   args_ptrs.size(), unsaved_files.data(),
-                                   unsaved_files.size(),
-                                   CXTranslationUnit_Incomplete));
-    if (!translation_unit)
-        return "{}";
-
-    CXFile file = clang_getFile(translation_unit, file_name);
-    auto const location = clang_getLocation(
-        translation_unit, file, location_info.line, location_info.col);
-    CXCursor const cursor = clang_getCursor(translation_unit, location);
-    static std::string result;
-    result = "{" + libclang_vim::stringize_cursor(
-                       cursor, clang_getCursorSemanticParent(cursor)) +
-             "}";
-
-    return result.c_str();
+    return libclang_vim::query_translation_unit(
+        location_info, [&](CXTranslationUnit translation_unit) {
+            return get_location_information(translation_unit, location_info);
+        });
 }
 // }}}
 
 // API to get extent of identifier at specific location {{{
 char const*
 vim_clang_get_extent_of_node_at_specific_location(char const* location_string) {
-    auto location_info =
+    auto const location_info =
         libclang_vim::parse_args_with_location(location_string);
-    char const* file_name = location_info.file.c_str();
-    auto const args_ptrs = libclang_vim::get_args_ptrs(location_info.args);
-    libclang_vim::cxindex_ptr index =
-        clang_createIndex(/*excludeDeclsFromPCH*/ 1, /*displayDiagnostics*/ 0);
-    std::vector<CXUnsavedFile> unsaved_files =
-        create_unsaved_files(location_info);
-    libclang_vim::cxtranslation_unit_ptr translation_unit(
-        clang_parseTranslationUnit(index, file_name, args_ptrs.data(),
-                                   args_ptrs.size(), unsaved_files.data(),
-                                   unsaved_files.size(),
-                                   CXTranslationUnit_Incomplete));
-    if (!translation_unit)
-        return "{}";
-
-    CXFile file = clang_getFile(translation_unit, file_name);
-    auto const location = clang_getLocation(
-        translation_unit, file, location_info.line, location_info.col);
-    CXCursor const cursor = clang_getCursor(translation_unit, location);
-    static std::string result;
-    result = "{" + libclang_vim::stringize_extent(cursor) + "}";
-
-    return result.c_str();
+    return libclang_vim::query_translation_unit(
+        location_info, [&](CXTranslationUnit translation_unit) {
+            return get_extent_of_node(translation_unit, location_info);
+        });
 }
 
 char const* vim_clang_get_inner_definition_extent_at_specific_location(
@@ -386,18 +720,14 @@ char const* vim_clang_get_expression_extent_at_specific_location(
     char const* location_string) {
     auto const parsed_location =
         libclang_vim::parse_args_with_location(location_string);
-    return libclang_vim::get_extent(parsed_location, [](CXCursor const& c) {
-        return clang_isExpression(clang_getCursorKind(c));
-    });
+    return libclang_vim::get_extent(parsed_location, is_expression);
 }
 
 char const* vim_clang_get_statement_extent_at_specific_location(
     char const* location_string) {
     auto const parsed_location =
         libclang_vim::parse_args_with_location(location_string);
-    return libclang_vim::get_extent(parsed_location, [](CXCursor const& c) {
-        return clang_isStatement(clang_getCursorKind(c));
-    });
+    return libclang_vim::get_extent(parsed_location, is_statement);
 }
 
 char const*
@@ -428,9 +758,7 @@ char const* vim_clang_get_namespace_extent_at_specific_location(
     char const* location_string) {
     auto const parsed_location =
         libclang_vim::parse_args_with_location(location_string);
-    return libclang_vim::get_extent(parsed_location, [](CXCursor const& c) {
-        return clang_getCursorKind(c) == CXCursor_Namespace;
-    });
+    return libclang_vim::get_extent(parsed_location, is_namespace);
 }
 // }}}
 
@@ -537,6 +865,27 @@ char const* vim_clang_get_completion_at(char const* location_string) {
     return ret;
 }
 
+char const* vim_clang_get_completion_items_at(char const* location_string) {
+    stderr_guard g;
+
+    const char* ret = libclang_vim::get_completion_items_at(
+        libclang_vim::parse_args_with_location(location_string));
+    return ret;
+}
+
+char const* vim_clang_completion_detail(char const* arguments) {
+    // "session:index"
+    char* end = nullptr;
+    unsigned long const session = std::strtoul(arguments, &end, 10);
+    if (*end != ':')
+        return "{}";
+    unsigned long const index = std::strtoul(end + 1, &end, 10);
+    if (*end != '\0')
+        return "{}";
+
+    return libclang_vim::get_completion_detail(session, index);
+}
+
 char const* vim_clang_get_comment_at(char const* location_string) {
     stderr_guard g;
 
@@ -565,7 +914,7 @@ char const* vim_clang_get_compile_commands(char const* file) {
     stderr_guard g;
 
     const char* ret = libclang_vim::get_compile_commands(
-        libclang_vim::parse_default_args(file).file);
+        libclang_vim::parse_default_args(file));
     return ret;
 }
 
@@ -577,6 +926,33 @@ char const* vim_clang_get_diagnostics(const char* file_and_args) {
     return ret;
 }
 
+char const* vim_clang_batch(char const* arguments) {
+    stderr_guard g;
+
+    std::vector<libclang_vim::batch_query> queries;
+    libclang_vim::location_tuple location_info =
+        libclang_vim::parse_batch_args(arguments, queries);
+    return libclang_vim::query_translation_unit(
+        location_info,
+        [&](CXTranslationUnit translation_unit) {
+            auto const& location_queries = get_location_queries();
+            std::string vimson = "[";
+            for (const auto& query : queries) {
+                auto const it = location_queries.find(query.api);
+                if (it == location_queries.end()) {
+                    vimson += "{},";
+                    continue;
+                }
+
+                location_info.line = query.line;
+                location_info.col = query.col;
+                vimson += it->second(translation_unit, location_info) + ",";
+            }
+            return vimson + "]";
+        },
+        "[]");
+}
+
 } // extern "C"
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
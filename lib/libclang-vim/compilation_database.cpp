@@ -0,0 +1,242 @@
+#include "compilation_database.hpp"
+
+#include <unordered_map>
+
+#include <sys/stat.h>
+
+#include <clang-c/CXCompilationDatabase.h>
+
+namespace {
+
+/// Arguments of a file in a database.
+class file_args {
+  public:
+    /// As in the database, without the file name.
+    libclang_vim::args_type command;
+    /// See compilation_database_cache::get_parse_args().
+    libclang_vim::args_type parse;
+
+    file_args();
+};
+
+file_args::file_args() = default;
+}
+
+/// A loaded compile_commands.json or compile_flags.txt.
+class libclang_vim::compilation_database_cache::database {
+    /// Not set for compile_flags.txt.
+    CXCompilationDatabase _database = nullptr;
+    /// The contents of compile_flags.txt, which are used for all files.
+    file_args _flags;
+    /// Arguments of the files looked up so far, also of the ones which are
+    /// not in the database.
+    std::unordered_map<std::string, file_args> _args;
+
+  public:
+    /// The file the database was loaded from.
+    file_stamp stamp;
+
+    database(const std::string& directory, const std::string& name);
+
+    database(const database&) = delete;
+    database& operator=(const database&) = delete;
+
+    ~database();
+
+    const file_args& get_args(const std::string& file);
+};
+
+namespace {
+
+/// In the order clang itself looks for them.
+const char* const database_names[] = {"compile_commands.json",
+                                      "compile_flags.txt"};
+
+/// Finds the nearest database in the parent directories of file, which is an
+/// absolute file name. Sets directory and name of the database.
+bool find_database(const std::string& file, std::string& directory,
+                   std::string& name) {
+    struct stat status {};
+    directory = file;
+    for (std::size_t found = directory.find_last_of('/');
+         found != std::string::npos; found = directory.find_last_of('/')) {
+        directory.erase(found);
+        for (const char* candidate : database_names) {
+            if (stat((directory + "/" + candidate).c_str(), &status) == 0) {
+                name = candidate;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/// One argument per line, as clang reads compile_flags.txt.
+libclang_vim::args_type read_flags(const std::string& file) {
+    libclang_vim::args_type flags;
+    std::ifstream stream(file.c_str());
+    std::string line;
+    while (std::getline(stream, line)) {
+        std::size_t const end = line.find_last_not_of(" \t\r");
+        if (end != std::string::npos)
+            flags.emplace_back(line.substr(0, end + 1));
+    }
+    return flags;
+}
+
+/// Drops the compiler (if has_compiler is set), the input file and the output
+/// options from command. Relative paths are relative to directory, which is
+/// not the working directory of the library, so they are made absolute.
+libclang_vim::args_type normalize_args(const libclang_vim::args_type& command,
+                                       const std::string& file,
+                                       const std::string& directory,
+                                       bool has_compiler) {
+    // Both "-I dir" and "-Idir" forms. -include-pch comes first, so that it's
+    // not taken for -include with a "-pch" file.
+    static const std::string path_options[] = {
+        "-I", "-isystem", "-iquote", "-idirafter", "-include-pch", "-include"};
+    auto const get_absolute = [&directory](const std::string& path) {
+        if (path.empty() || path[0] == '/')
+            return path;
+        return directory + "/" + path;
+    };
+
+    libclang_vim::args_type args;
+    for (std::size_t i = has_compiler ? 1 : 0; i < command.size(); ++i) {
+        const std::string& arg = command[i];
+        if (arg == "-c" || get_absolute(arg) == file)
+            continue;
+
+        if (arg == "-o") {
+            ++i;
+            continue;
+        }
+
+        // -ofile, but not the -objc... options.
+        if (arg.compare(0, 2, "-o") == 0 && arg.compare(0, 4, "-obj") != 0)
+            continue;
+
+        bool is_path_option = false;
+        for (const std::string& option : path_options) {
+            if (arg.compare(0, option.size(), option) != 0)
+                continue;
+
+            is_path_option = true;
+            if (arg.size() > option.size()) {
+                args.push_back(option +
+                               get_absolute(arg.substr(option.size())));
+            } else {
+                args.push_back(arg);
+                if (i + 1 < command.size())
+                    args.push_back(get_absolute(command[++i]));
+            }
+            break;
+        }
+        if (!is_path_option)
+            args.push_back(arg);
+    }
+    return args;
+}
+}
+
+libclang_vim::compilation_database_cache::database::database(
+    const std::string& directory, const std::string& name) {
+    if (name == "compile_flags.txt") {
+        _flags.command = read_flags(directory + "/" + name);
+        _flags.parse =
+            normalize_args(_flags.command, std::string(), directory, false);
+        return;
+    }
+
+    CXCompilationDatabase_Error error;
+    _database = clang_CompilationDatabase_fromDirectory(
+        directory.empty() ? "/" : directory.c_str(), &error);
+    if (error != CXCompilationDatabase_NoError && _database) {
+        clang_CompilationDatabase_dispose(_database);
+        _database = nullptr;
+    }
+}
+
+libclang_vim::compilation_database_cache::database::~database() {
+    if (_database)
+        clang_CompilationDatabase_dispose(_database);
+}
+
+const file_args& libclang_vim::compilation_database_cache::database::get_args(
+    const std::string& file) {
+    if (!_database)
+        return _flags;
+
+    auto const it = _args.find(file);
+    if (it != _args.end())
+        return it->second;
+
+    file_args& args = _args[file];
+    CXCompileCommands commands =
+        clang_CompilationDatabase_getCompileCommands(_database, file.c_str());
+    if (clang_CompileCommands_getSize(commands) >= 1) {
+        CXCompileCommand command =
+            clang_CompileCommands_getCommand(commands, 0);
+        unsigned const size = clang_CompileCommand_getNumArgs(command);
+        for (unsigned i = 0; i < size; ++i) {
+            cxstring_ptr arg = clang_CompileCommand_getArg(command, i);
+            if (file != to_c_str(arg))
+                args.command.emplace_back(to_c_str(arg));
+        }
+
+        cxstring_ptr directory = clang_CompileCommand_getDirectory(command);
+        args.parse =
+            normalize_args(args.command, file, to_c_str(directory), true);
+    }
+    clang_CompileCommands_dispose(commands);
+    return args;
+}
+
+libclang_vim::compilation_database_cache::compilation_database_cache() =
+    default;
+
+libclang_vim::compilation_database_cache&
+libclang_vim::compilation_database_cache::instance() {
+    static compilation_database_cache cache;
+    return cache;
+}
+
+bool libclang_vim::compilation_database_cache::lookup(const std::string& file,
+                                                      bool parse,
+                                                      args_type& args) {
+    std::string const path = get_absolute_path(file);
+    std::string directory;
+    std::string name;
+    if (!find_database(path, directory, name))
+        return false;
+
+    std::string const database_file = directory + "/" + name;
+    // Nanoseconds, as a database may be rewritten within a second.
+    file_stamp const stamp = get_file_stamp(database_file);
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto& cached = _databases[database_file];
+    if (!cached || cached->stamp != stamp) {
+        cached = std::make_shared<database>(directory, name);
+        cached->stamp = stamp;
+    }
+    const file_args& found = cached->get_args(path);
+    args = parse ? found.parse : found.command;
+    return true;
+}
+
+bool libclang_vim::compilation_database_cache::get_args(const std::string& file,
+                                                        args_type& args) {
+    return lookup(file, false, args);
+}
+
+bool libclang_vim::compilation_database_cache::get_parse_args(
+    const std::string& file, args_type& args) {
+    return lookup(file, true, args);
+}
+
+void libclang_vim::compilation_database_cache::clear() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _databases.clear();
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
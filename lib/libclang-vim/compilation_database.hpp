@@ -0,0 +1,52 @@
+#if !defined LIBCLANG_VIM_COMPILATION_DATABASE_HPP_INCLUDED
+#define LIBCLANG_VIM_COMPILATION_DATABASE_HPP_INCLUDED
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "helpers.hpp"
+
+namespace libclang_vim {
+
+/// Keeps the compile_commands.json and compile_flags.txt files found so far
+/// loaded, till they change on disk. Looking up a file again is a hash
+/// lookup, instead of loading the whole database again.
+class compilation_database_cache {
+    class database;
+
+    std::mutex _mutex;
+    /// Databases by the absolute name of their file.
+    std::map<std::string, std::shared_ptr<database>> _databases;
+
+    compilation_database_cache();
+
+    /// Implements get_args() and get_parse_args().
+    bool lookup(const std::string& file, bool parse, args_type& args);
+
+  public:
+    compilation_database_cache(const compilation_database_cache&) = delete;
+    compilation_database_cache&
+    operator=(const compilation_database_cache&) = delete;
+
+    static compilation_database_cache& instance();
+
+    /// Sets args to the arguments of file in the nearest database of its
+    /// parent directories, without the file name itself. Returns false if
+    /// no database was found.
+    bool get_args(const std::string& file, args_type& args);
+
+    /// Same, but args are suitable for clang_parseTranslationUnit(): without
+    /// the compiler and the output options, include paths made absolute.
+    bool get_parse_args(const std::string& file, args_type& args);
+
+    /// Forgets all databases.
+    void clear();
+};
+
+} // namespace libclang_vim
+
+#endif // LIBCLANG_VIM_COMPILATION_DATABASE_HPP_INCLUDED
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,389 @@
+#include "completion.hpp"
+#include "vimson_writer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdlib>
+#include <tuple>
+#include <unordered_map>
+
+namespace {
+
+/// Classes of matches, see match_completion().
+enum match_class : unsigned {
+    exact_prefix = 0,
+    case_insensitive_prefix,
+    subsequence,
+};
+
+/// Leaves room for the number of skipped characters in a score.
+const unsigned class_shift = 20;
+
+bool equal_ignoring_case(char a, char b) {
+    return std::tolower(static_cast<unsigned char>(a)) ==
+           std::tolower(static_cast<unsigned char>(b));
+}
+
+bool is_identifier_char(char c) {
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+/// Concatenates the CXCompletionChunk_TypedText chunks of completion_string.
+std::string get_typed_text(const CXCompletionString& completion_string) {
+    std::string text;
+    unsigned const chunks = clang_getNumCompletionChunks(completion_string);
+    for (unsigned i = 0; i < chunks; ++i) {
+        if (clang_getCompletionChunkKind(completion_string, i) !=
+            CXCompletionChunk_TypedText)
+            continue;
+
+        libclang_vim::cxstring_ptr chunk_text =
+            clang_getCompletionChunkText(completion_string, i);
+        text += libclang_vim::to_c_str(chunk_text);
+    }
+    return text;
+}
+
+bool is_better(const libclang_vim::completion_candidate& a,
+               const libclang_vim::completion_candidate& b) {
+    return std::make_tuple(a.score, a.priority, a.text.size(),
+                           std::cref(a.text), a.index) <
+           std::make_tuple(b.score, b.priority, b.text.size(),
+                           std::cref(b.text), b.index);
+}
+
+unsigned long get_next_session_id() {
+    static std::atomic<unsigned long> counter(0);
+    return ++counter;
+}
+
+const char* get_availability_spelling(CXAvailabilityKind availability) {
+    switch (availability) {
+    case CXAvailability_Available:
+        return "available";
+    case CXAvailability_Deprecated:
+        return "deprecated";
+    case CXAvailability_NotAvailable:
+        return "not_available";
+    case CXAvailability_NotAccessible:
+        return "not_accessible";
+    }
+    return "";
+}
+
+/// Appends the text of the chunks of completion_string to signature, optional
+/// ones in brackets. Placeholders are also collected into parameters.
+void append_signature(const CXCompletionString& completion_string,
+                      std::string& signature, std::string& result_type,
+                      std::vector<std::string>& parameters) {
+    unsigned const chunks = clang_getNumCompletionChunks(completion_string);
+    for (unsigned i = 0; i < chunks; ++i) {
+        CXCompletionChunkKind const kind =
+            clang_getCompletionChunkKind(completion_string, i);
+        if (kind == CXCompletionChunk_Optional) {
+            signature += '[';
+            append_signature(
+                clang_getCompletionChunkCompletionString(completion_string, i),
+                signature, result_type, parameters);
+            signature += ']';
+            continue;
+        }
+
+        libclang_vim::cxstring_ptr text =
+            clang_getCompletionChunkText(completion_string, i);
+        const char* const spelling = libclang_vim::to_c_str(text);
+        if (!spelling)
+            continue;
+
+        switch (kind) {
+        case CXCompletionChunk_ResultType:
+            result_type = spelling;
+            break;
+        case CXCompletionChunk_Informative:
+            break;
+        case CXCompletionChunk_Placeholder:
+        case CXCompletionChunk_CurrentParameter:
+            parameters.emplace_back(spelling);
+            signature += spelling;
+            break;
+        default:
+            signature += spelling;
+            break;
+        }
+    }
+}
+}
+
+libclang_vim::completion_candidate::completion_candidate() = default;
+
+bool libclang_vim::match_completion(const std::string& prefix,
+                                    const std::string& text, unsigned& score) {
+    if (text.compare(0, prefix.size(), prefix) == 0) {
+        score = exact_prefix << class_shift;
+        return true;
+    }
+
+    if (prefix.size() <= text.size() &&
+        std::equal(prefix.begin(), prefix.end(), text.begin(),
+                   equal_ignoring_case)) {
+        score = case_insensitive_prefix << class_shift;
+        return true;
+    }
+
+    // Greedy subsequence match, counting the characters skipped after the
+    // first match.
+    std::size_t position = 0;
+    unsigned skipped = 0;
+    for (std::size_t i = 0; i < prefix.size(); ++i, ++position) {
+        std::size_t const found = position;
+        while (position < text.size() &&
+               !equal_ignoring_case(text[position], prefix[i]))
+            ++position;
+        if (position == text.size())
+            return false;
+        if (i > 0)
+            skipped += position - found;
+    }
+    unsigned const max_skipped = (1U << class_shift) - 1;
+    score = (subsequence << class_shift) | std::min(skipped, max_skipped);
+    return true;
+}
+
+std::vector<libclang_vim::completion_candidate>
+libclang_vim::rank_completions(std::vector<completion_candidate> candidates,
+                               const std::string& prefix, std::size_t limit,
+                               bool unique) {
+    std::vector<completion_candidate> ranked;
+    ranked.reserve(candidates.size());
+    // Indexes into ranked by text.
+    std::unordered_map<std::string, std::size_t> seen;
+    for (auto& candidate : candidates) {
+        if (!match_completion(prefix, candidate.text, candidate.score))
+            continue;
+
+        auto const it = unique ? seen.find(candidate.text) : seen.end();
+        if (it != seen.end()) {
+            unsigned& priority = ranked[it->second].priority;
+            priority = std::min(priority, candidate.priority);
+            continue;
+        }
+
+        if (unique)
+            seen.emplace(candidate.text, ranked.size());
+        ranked.push_back(std::move(candidate));
+    }
+
+    // Only the best limit candidates have to be sorted.
+    if (limit == 0 || limit > ranked.size())
+        limit = ranked.size();
+    std::partial_sort(ranked.begin(), ranked.begin() + limit, ranked.end(),
+                      is_better);
+    ranked.resize(limit);
+    return ranked;
+}
+
+libclang_vim::completion_session::completion_session(
+    CXCodeCompleteResults* results)
+    : _results(results), id(get_next_session_id()) {}
+
+libclang_vim::completion_session::~completion_session() {
+    if (_results)
+        clang_disposeCodeCompleteResults(_results);
+}
+
+const CXCodeCompleteResults*
+libclang_vim::completion_session::results() const {
+    return _results;
+}
+
+libclang_vim::completion_sessions::entry::entry() = default;
+
+libclang_vim::completion_sessions::completion_sessions() = default;
+
+libclang_vim::completion_sessions&
+libclang_vim::completion_sessions::instance() {
+    static completion_sessions sessions;
+    return sessions;
+}
+
+std::shared_ptr<const libclang_vim::completion_session>
+libclang_vim::completion_sessions::find(const key_type& key,
+                                        std::uint64_t generation) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto const it = _entries.find(key);
+    if (it == _entries.end() || it->second.generation != generation)
+        return nullptr;
+
+    it->second.last_use = ++_use_counter;
+    return it->second.session;
+}
+
+void libclang_vim::completion_sessions::add(
+    const key_type& key, std::uint64_t generation,
+    std::shared_ptr<const completion_session> session) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_entries.size() >= max_entries &&
+        _entries.find(key) == _entries.end()) {
+        auto oldest = _entries.begin();
+        for (auto it = _entries.begin(); it != _entries.end(); ++it) {
+            if (it->second.last_use < oldest->second.last_use)
+                oldest = it;
+        }
+        _entries.erase(oldest);
+    }
+
+    entry& added = _entries[key];
+    added.generation = generation;
+    added.last_use = ++_use_counter;
+    added.session = std::move(session);
+}
+
+std::shared_ptr<const libclang_vim::completion_session>
+libclang_vim::completion_sessions::find(unsigned long id) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (auto& it : _entries) {
+        if (it.second.session->id == id) {
+            it.second.last_use = ++_use_counter;
+            return it.second.session;
+        }
+    }
+    return nullptr;
+}
+
+void libclang_vim::completion_sessions::clear() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _entries.clear();
+}
+
+bool libclang_vim::get_completion_key(const location_tuple& location_info,
+                                      completion_sessions::key_type& key,
+                                      std::uint64_t& generation) {
+    // Unsaved contents are hashed in place, only a saved file is read.
+    std::vector<char> file_contents;
+    const char* contents = nullptr;
+    std::size_t size = 0;
+    if (location_info.unsaved_file) {
+        contents = location_info.unsaved_file->data();
+        size = location_info.unsaved_file->size();
+    } else {
+        file_contents = get_file_contents(location_info);
+        contents = file_contents.data();
+        size = file_contents.size();
+    }
+
+    // Find the offset of the location, the column counts bytes.
+    std::size_t line_begin = 0;
+    for (std::size_t line = 1; line < location_info.line; ++line) {
+        const char* const it =
+            std::find(contents + line_begin, contents + size, '\n');
+        if (it == contents + size)
+            return false;
+        line_begin = it - contents + 1;
+    }
+    if (location_info.col == 0 || line_begin + location_info.col - 1 > size)
+        return false;
+
+    std::size_t const offset = line_begin + location_info.col - 1;
+    std::size_t begin = offset;
+    while (begin > line_begin && is_identifier_char(contents[begin - 1]))
+        --begin;
+    std::size_t end = offset;
+    while (end < size && is_identifier_char(contents[end]))
+        ++end;
+
+    key = completion_sessions::key_type(
+        get_absolute_path(location_info.file), location_info.args,
+        location_info.line, location_info.col - (offset - begin));
+    generation = hash_bytes(contents, begin);
+    generation = hash_bytes(contents + end, size - end, generation);
+    return true;
+}
+
+std::shared_ptr<const libclang_vim::completion_session>
+libclang_vim::complete_at(CXTranslationUnit translation_unit,
+                          const location_tuple& location_info) {
+    std::vector<CXUnsavedFile> unsaved_files =
+        create_unsaved_files(location_info);
+    CXCodeCompleteResults* results = clang_codeCompleteAt(
+        translation_unit, location_info.file.c_str(), location_info.line,
+        location_info.col, unsaved_files.data(), unsaved_files.size(),
+        clang_defaultCodeCompleteOptions() |
+            CXCodeComplete_IncludeBriefComments);
+    auto session = std::make_shared<completion_session>(results);
+    if (results) {
+        session->candidates.resize(results->NumResults);
+        for (unsigned i = 0; i < results->NumResults; ++i) {
+            const CXCompletionString& completion_string =
+                results->Results[i].CompletionString;
+            session->candidates[i].index = i;
+            session->candidates[i].text = get_typed_text(completion_string);
+            session->candidates[i].kind = results->Results[i].CursorKind;
+            session->candidates[i].priority =
+                clang_getCompletionPriority(completion_string);
+        }
+    }
+    return session;
+}
+
+std::string
+libclang_vim::write_completion_items(const completion_session& session,
+                                     const location_tuple& location_info) {
+    std::size_t const limit = std::strtoul(
+        get_option(location_info, "limit", "0").c_str(), nullptr, 10);
+    std::vector<completion_candidate> const ranked =
+        rank_completions(session.candidates,
+                         get_option(location_info, "prefix"), limit, false);
+
+    vimson_writer writer;
+    writer.append("{'session':").append_number(session.id);
+    writer.append(",'items':[");
+    for (const auto& candidate : ranked) {
+        cxstring_ptr kind = clang_getCursorKindSpelling(candidate.kind);
+        writer.append("{'index':").append_number(candidate.index).append(',');
+        writer.append("'word':'").append_escaped(candidate.text.c_str());
+        writer.append("',");
+        writer.append_key_value("kind", to_c_str(kind));
+        writer.append("'priority':").append_number(candidate.priority);
+        writer.append("},");
+    }
+    writer.append("]}");
+    return writer.release();
+}
+
+std::string
+libclang_vim::write_completion_detail(const completion_session& session,
+                                      std::size_t index) {
+    const CXCodeCompleteResults* results = session.results();
+    if (!results || index >= results->NumResults)
+        return "{}";
+
+    const CXCompletionString& completion_string =
+        results->Results[index].CompletionString;
+    std::string signature;
+    std::string result_type;
+    std::vector<std::string> parameters;
+    append_signature(completion_string, signature, result_type, parameters);
+    cxstring_ptr brief = clang_getCompletionBriefComment(completion_string);
+
+    vimson_writer writer;
+    writer.append('{');
+    writer.append_key_value("signature", signature.c_str());
+    writer.append_key_value("result_type", result_type.c_str());
+    writer.append("'parameters':[");
+    for (const auto& parameter : parameters)
+        writer.append('\'').append_escaped(parameter.c_str()).append("',");
+    writer.append("],");
+    writer.append_key_value(
+        "availability",
+        get_availability_spelling(
+            clang_getCompletionAvailability(completion_string)));
+    writer.append("'priority':")
+        .append_number(clang_getCompletionPriority(completion_string))
+        .append(',');
+    writer.append_key_value("brief", to_c_str(brief));
+    writer.append('}');
+    return writer.release();
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,145 @@
+#if !defined LIBCLANG_VIM_COMPLETION_HPP_INCLUDED
+#define LIBCLANG_VIM_COMPLETION_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <clang-c/Index.h>
+
+#include "helpers.hpp"
+
+namespace libclang_vim {
+
+/// A result of clang_codeCompleteAt(), reduced to what ranking needs.
+class completion_candidate {
+  public:
+    /// Index of the result in CXCodeCompleteResults.
+    unsigned index = 0;
+    std::string text;
+    CXCursorKind kind = CXCursor_NotImplemented;
+    /// See clang_getCompletionPriority(), smaller is better.
+    unsigned priority = 0;
+    /// How well text matches the typed prefix, smaller is better.
+    unsigned score = 0;
+
+    completion_candidate();
+};
+
+/// Scores how well text matches prefix: case-sensitive prefixes first, then
+/// case-insensitive ones, then the rest of the case-insensitive subsequences,
+/// the ones with less skipped characters first. Returns false if prefix is
+/// not a subsequence of text at all.
+bool match_completion(const std::string& prefix, const std::string& text,
+                      unsigned& score);
+
+/// Drops the candidates not matching prefix and, if unique is set, the
+/// duplicates (e.g. overloads), then keeps the best limit ones, best first. A
+/// limit of 0 means no limit.
+std::vector<completion_candidate>
+rank_completions(std::vector<completion_candidate> candidates,
+                 const std::string& prefix, std::size_t limit,
+                 bool unique = true);
+
+/// The results of a clang_codeCompleteAt() call.
+class completion_session {
+    CXCodeCompleteResults* _results;
+
+  public:
+    /// Unique in the process, so that outdated ids are just not found.
+    unsigned long const id;
+    std::vector<completion_candidate> candidates;
+
+    /// Takes ownership of results, which may be nullptr.
+    explicit completion_session(CXCodeCompleteResults* results);
+
+    completion_session(const completion_session&) = delete;
+    completion_session& operator=(const completion_session&) = delete;
+
+    ~completion_session();
+
+    /// Details like the signature are read only when they are needed.
+    const CXCodeCompleteResults* results() const;
+};
+
+/// Keeps the recent completion sessions. While an identifier is typed, the
+/// completions at its start don't change, so the following keystrokes are
+/// answered from the session without reparsing and completing again.
+class completion_sessions {
+  public:
+    /// Absolute file name, compiler arguments, line and the column where the
+    /// identifier starts.
+    using key_type = std::tuple<std::string, args_type, unsigned, unsigned>;
+
+  private:
+    struct entry {
+        /// See get_completion_key().
+        std::uint64_t generation = 0;
+        unsigned long last_use = 0;
+        std::shared_ptr<const completion_session> session;
+
+        entry();
+    };
+
+    std::mutex _mutex;
+    std::map<key_type, entry> _entries;
+    unsigned long _use_counter = 0;
+
+    completion_sessions();
+
+  public:
+    /// Number of sessions kept at the same time.
+    static const std::size_t max_entries = 8;
+
+    completion_sessions(const completion_sessions&) = delete;
+    completion_sessions& operator=(const completion_sessions&) = delete;
+
+    static completion_sessions& instance();
+
+    /// Returns the session of key if it has the same generation.
+    std::shared_ptr<const completion_session> find(const key_type& key,
+                                                   std::uint64_t generation);
+
+    void add(const key_type& key, std::uint64_t generation,
+             std::shared_ptr<const completion_session> session);
+
+    /// Returns the session with id, nullptr if it's not kept any more.
+    std::shared_ptr<const completion_session> find(unsigned long id);
+
+    void clear();
+};
+
+/// Sets key to the session key of location_info, and generation to a hash of
+/// the buffer without the identifier at the location, which stays the same
+/// while the identifier is typed. Returns false if the location is not in the
+/// file.
+bool get_completion_key(const location_tuple& location_info,
+                        completion_sessions::key_type& key,
+                        std::uint64_t& generation);
+
+/// Wrapper around clang_codeCompleteAt().
+std::shared_ptr<const completion_session>
+complete_at(CXTranslationUnit translation_unit,
+            const location_tuple& location_info);
+
+/// Writes the id of session and the index, typed text, kind and priority of
+/// its candidates, ranked like the list of get_completion_at(), but keeping
+/// overloads.
+std::string write_completion_items(const completion_session& session,
+                                   const location_tuple& location_info);
+
+/// Writes the signature, result type, parameters, availability, priority and
+/// brief comment of the result at index of session, {} if there is none.
+std::string write_completion_detail(const completion_session& session,
+                                    std::size_t index);
+
+} // namespace libclang_vim
+
+#endif // LIBCLANG_VIM_COMPLETION_HPP_INCLUDED
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
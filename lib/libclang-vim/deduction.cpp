@@ -1,6 +1,8 @@
 #include "deduction.hpp"
-
-#include <clang-c/CXCompilationDatabase.h>
+#include "compilation_database.hpp"
+#include "completion.hpp"
+#include "result_arena.hpp"
+#include "translation_unit_cache.hpp"
 
 namespace {
 
@@ -8,54 +10,75 @@ namespace {
 /// parent directories.
 libclang_vim::args_type parse_compilation_database(const std::string& file) {
     libclang_vim::args_type ret;
+    if (!libclang_vim::compilation_database_cache::instance().get_args(file,
+                                                                       ret)) {
+        // Our default when no database was found.
+        ret.emplace_back("-std=c++1y");
+    }
 
-    std::size_t found = file.find_last_of("/\\");
-    std::string directory = file.substr(0, found);
-    while (true) {
-        std::string json =
-            directory + file.substr(found, 1) + "compile_commands.json";
-        std::ifstream stream(json.c_str());
-        if (stream.good())
-            break;
+    return ret;
+}
 
-        found = directory.find_last_of("/\\");
-        if (found == std::string::npos)
-            break;
+/// Finds the completion session of a location, or creates it.
+class completion_lookup {
+    libclang_vim::completion_sessions::key_type _key;
+    std::uint64_t _generation = 0;
+    bool _has_key;
 
-        directory = directory.substr(0, found);
-    }
+  public:
+    /// nullptr till complete() if there was no session.
+    std::shared_ptr<const libclang_vim::completion_session> session;
 
-    if (directory.empty()) {
-        // Our default when no JSON was found.
-        ret.emplace_back("-std=c++1y");
+    explicit completion_lookup(const libclang_vim::location_tuple& location);
 
-        return ret;
-    }
+    void complete(CXTranslationUnit translation_unit,
+                  const libclang_vim::location_tuple& location);
+};
 
-    CXCompilationDatabase_Error error;
-    CXCompilationDatabase database =
-        clang_CompilationDatabase_fromDirectory(directory.c_str(), &error);
-    if (error == CXCompilationDatabase_NoError) {
-        CXCompileCommands commands =
-            clang_CompilationDatabase_getCompileCommands(database,
-                                                         file.c_str());
-        unsigned commandsSize = clang_CompileCommands_getSize(commands);
-        if (commandsSize >= 1) {
-            CXCompileCommand command =
-                clang_CompileCommands_getCommand(commands, 0);
-            unsigned args = clang_CompileCommand_getNumArgs(command);
-            for (unsigned i = 0; i < args; ++i) {
-                libclang_vim::cxstring_ptr arg =
-                    clang_CompileCommand_getArg(command, i);
-                if (file != clang_getCString(arg))
-                    ret.emplace_back(clang_getCString(arg));
-            }
-        }
-        clang_CompileCommands_dispose(commands);
+completion_lookup::completion_lookup(
+    const libclang_vim::location_tuple& location)
+    : _has_key(libclang_vim::get_completion_key(location, _key, _generation)) {
+    if (_has_key)
+        session = libclang_vim::completion_sessions::instance().find(
+            _key, _generation);
+}
+
+void completion_lookup::complete(CXTranslationUnit translation_unit,
+                                 const libclang_vim::location_tuple& location) {
+    session = libclang_vim::complete_at(translation_unit, location);
+    if (_has_key)
+        libclang_vim::completion_sessions::instance().add(_key, _generation,
+                                                          session);
+}
+
+/// Writes the typed texts of the candidates of session as a list. Without a
+/// prefix or a limit, all of them are sorted by name.
+std::string write_completions(const libclang_vim::completion_session& session,
+                              const libclang_vim::location_tuple& location) {
+    std::string const prefix = libclang_vim::get_option(location, "prefix");
+    std::size_t const limit = std::strtoul(
+        libclang_vim::get_option(location, "limit", "0").c_str(), nullptr, 10);
+    std::vector<std::string> matches;
+    if (prefix.empty() && limit == 0) {
+        std::set<std::string> sorted;
+        for (const auto& candidate : session.candidates)
+            sorted.insert(candidate.text);
+        matches.assign(sorted.begin(), sorted.end());
+    } else {
+        for (auto& candidate : libclang_vim::rank_completions(
+                 session.candidates, prefix, limit))
+            matches.push_back(std::move(candidate.text));
     }
-    clang_CompilationDatabase_dispose(database);
 
-    return ret;
+    std::stringstream ss;
+    ss << "['";
+    for (auto it = matches.begin(); it != matches.end(); ++it) {
+        if (it != matches.begin())
+            ss << "', '";
+        ss << *it;
+    }
+    ss << "']";
+    return ss.str();
 }
 
 CXChildVisitResult valid_type_cursor_getter(CXCursor cursor,
@@ -157,10 +180,12 @@ CXType deduce_type_at_cursor(const CXCursor& cursor) {
 }
 }
 
-const char*
-libclang_vim::deduce_var_decl_type(const location_tuple& location_info) {
+std::string
+libclang_vim::deduce_var_decl_type(CXTranslationUnit translation_unit,
+                                   const location_tuple& location_info) {
     return at_specific_location(
-        location_info, [](const CXCursor& cursor) -> std::string {
+        translation_unit, location_info,
+        [](const CXCursor& cursor) -> std::string {
             const CXCursor var_decl_cursor =
                 search_kind(cursor, [](const CXCursorKind& kind) {
                     return kind == CXCursor_VarDecl;
@@ -183,9 +208,19 @@ libclang_vim::deduce_var_decl_type(const location_tuple& location_info) {
 }
 
 const char*
-libclang_vim::deduce_func_or_var_decl(const location_tuple& location_info) {
+libclang_vim::deduce_var_decl_type(const location_tuple& location_info) {
+    return query_translation_unit(
+        location_info, [&](CXTranslationUnit translation_unit) {
+            return deduce_var_decl_type(translation_unit, location_info);
+        });
+}
+
+std::string
+libclang_vim::deduce_func_or_var_decl(CXTranslationUnit translation_unit,
+                                      const location_tuple& location_info) {
     return at_specific_location(
-        location_info, [](const CXCursor& cursor) -> std::string {
+        translation_unit, location_info,
+        [](const CXCursor& cursor) -> std::string {
             const CXCursor func_or_var_decl =
                 search_kind(cursor, [](const CXCursorKind& kind) {
                     return kind == CXCursor_VarDecl ||
@@ -213,9 +248,19 @@ libclang_vim::deduce_func_or_var_decl(const location_tuple& location_info) {
 }
 
 const char*
-libclang_vim::deduce_func_return_type(const location_tuple& location_info) {
+libclang_vim::deduce_func_or_var_decl(const location_tuple& location_info) {
+    return query_translation_unit(
+        location_info, [&](CXTranslationUnit translation_unit) {
+            return deduce_func_or_var_decl(translation_unit, location_info);
+        });
+}
+
+std::string
+libclang_vim::deduce_func_return_type(CXTranslationUnit translation_unit,
+                                      const location_tuple& location_info) {
     return at_specific_location(
-        location_info, [](CXCursor const& cursor) -> std::string {
+        translation_unit, location_info,
+        [](CXCursor const& cursor) -> std::string {
             CXCursor const func_decl_cursor =
                 search_kind(cursor, [](const CXCursorKind& kind) {
                     return is_function_decl_kind(kind);
@@ -238,9 +283,20 @@ libclang_vim::deduce_func_return_type(const location_tuple& location_info) {
         });
 }
 
-const char* libclang_vim::deduce_type_at(const location_tuple& location_info) {
+const char*
+libclang_vim::deduce_func_return_type(const location_tuple& location_info) {
+    return query_translation_unit(
+        location_info, [&](CXTranslationUnit translation_unit) {
+            return deduce_func_return_type(translation_unit, location_info);
+        });
+}
+
+std::string
+libclang_vim::deduce_type_at(CXTranslationUnit translation_unit,
+                             const location_tuple& location_info) {
     return at_specific_location(
-        location_info, [](CXCursor const& cursor) -> std::string {
+        translation_unit, location_info,
+        [](CXCursor const& cursor) -> std::string {
             CXCursor valid_cursor = cursor;
             if (is_invalid_type_cursor(valid_cursor)) {
                 clang_visitChildren(cursor, valid_type_cursor_getter,
@@ -270,48 +326,34 @@ const char* libclang_vim::deduce_type_at(const location_tuple& location_info) {
         });
 }
 
-const char* libclang_vim::get_compile_commands(const std::string& file) {
-    static std::string vimson;
-
-    // Write the header.
-    std::stringstream ss;
-    ss << "{'commands':'";
-
-    args_type args = parse_compilation_database(file);
-    for (std::size_t i = 0; i < args.size(); ++i) {
-        if (i)
-            ss << " ";
-        ss << args[i];
-    }
-
-    // Write the footer.
-    ss << "'}";
-    vimson = ss.str();
-    return vimson.c_str();
+const char* libclang_vim::deduce_type_at(const location_tuple& location_info) {
+    return query_translation_unit(
+        location_info, [&](CXTranslationUnit translation_unit) {
+            return deduce_type_at(translation_unit, location_info);
+        });
 }
 
 const char*
-libclang_vim::get_current_function_at(const location_tuple& location_info) {
-    static std::string vimson;
+libclang_vim::get_compile_commands(const location_tuple& location_info) {
+    // Quoted, so that passing the commands back as compiler args gives the
+    // same arguments.
+    std::string const commands =
+        join_compiler_args(parse_compilation_database(location_info.file));
+    vimson_writer writer;
+    writer.append("{'commands':'").append_escaped(commands.c_str());
+    writer.append("'}");
+    return store_result(writer.release(), location_info);
+}
 
+std::string
+libclang_vim::get_current_function_at(CXTranslationUnit translation_unit,
+                                      const location_tuple& location_info) {
     // Write the header.
     std::stringstream ss;
     ss << "{'name':'";
 
     // Write the actual name.
-    cxindex_ptr index = clang_createIndex(/*excludeDeclarationsFromPCH=*/1,
-                                          /*displayDiagnostics=*/0);
-
     std::string file_name = location_info.file;
-    std::vector<const char*> args_ptrs = get_args_ptrs(location_info.args);
-    std::vector<CXUnsavedFile> unsaved_files =
-        create_unsaved_files(location_info);
-    unsigned options = CXTranslationUnit_Incomplete;
-    cxtranslation_unit_ptr translation_unit(clang_parseTranslationUnit(
-        index, file_name.c_str(), args_ptrs.data(), args_ptrs.size(),
-        unsaved_files.data(), unsaved_files.size(), options));
-    if (!translation_unit)
-        return "{}";
 
     CXFile file = clang_getFile(translation_unit, file_name.c_str());
     unsigned line = location_info.line;
@@ -367,32 +409,26 @@ libclang_vim::get_current_function_at(const location_tuple& location_info) {
 
     // Write the footer.
     ss << "'}";
-    vimson = ss.str();
-    return vimson.c_str();
+    return ss.str();
 }
 
 const char*
-libclang_vim::get_full_name_at(const location_tuple& location_info) {
-    static std::string vimson;
+libclang_vim::get_current_function_at(const location_tuple& location_info) {
+    return query_translation_unit(
+        location_info, [&](CXTranslationUnit translation_unit) {
+            return get_current_function_at(translation_unit, location_info);
+        });
+}
 
+std::string
+libclang_vim::get_full_name_at(CXTranslationUnit translation_unit,
+                               const location_tuple& location_info) {
     // Write the header.
     std::stringstream ss;
     ss << "{'name':'";
 
     // Write the actual name.
-    cxindex_ptr index = clang_createIndex(/*excludeDeclarationsFromPCH=*/1,
-                                          /*displayDiagnostics=*/0);
-
     std::string file_name = location_info.file;
-    std::vector<const char*> args_ptrs = get_args_ptrs(location_info.args);
-    std::vector<CXUnsavedFile> unsaved_files =
-        create_unsaved_files(location_info);
-    unsigned options = CXTranslationUnit_Incomplete;
-    cxtranslation_unit_ptr translation_unit(clang_parseTranslationUnit(
-        index, file_name.c_str(), args_ptrs.data(), args_ptrs.size(),
-        unsaved_files.data(), unsaved_files.size(), options));
-    if (!translation_unit)
-        return "{}";
 
     CXFile file = clang_getFile(translation_unit, file_name.c_str());
     unsigned line = location_info.line;
@@ -435,31 +471,26 @@ libclang_vim::get_full_name_at(const location_tuple& location_info) {
 
     // Write the footer.
     ss << "'}";
-    vimson = ss.str();
-    return vimson.c_str();
+    return ss.str();
 }
 
-const char* libclang_vim::get_comment_at(const location_tuple& location_info) {
-    static std::string vimson;
+const char*
+libclang_vim::get_full_name_at(const location_tuple& location_info) {
+    return query_translation_unit(
+        location_info, [&](CXTranslationUnit translation_unit) {
+            return get_full_name_at(translation_unit, location_info);
+        });
+}
 
+std::string
+libclang_vim::get_comment_at(CXTranslationUnit translation_unit,
+                             const location_tuple& location_info) {
     // Write the header.
     std::stringstream ss;
     ss << "{'brief':'";
 
     // Write the actual comment.
-    cxindex_ptr index = clang_createIndex(/*excludeDeclarationsFromPCH=*/1,
-                                          /*displayDiagnostics=*/0);
-
     std::string file_name = location_info.file;
-    std::vector<const char*> args_ptrs = get_args_ptrs(location_info.args);
-    std::vector<CXUnsavedFile> unsaved_files =
-        create_unsaved_files(location_info);
-    unsigned options = CXTranslationUnit_Incomplete;
-    cxtranslation_unit_ptr translation_unit(clang_parseTranslationUnit(
-        index, file_name.c_str(), args_ptrs.data(), args_ptrs.size(),
-        unsaved_files.data(), unsaved_files.size(), options));
-    if (!translation_unit)
-        return "{}";
 
     CXFile file = clang_getFile(translation_unit, file_name.c_str());
     int line = location_info.line;
@@ -487,32 +518,25 @@ const char* libclang_vim::get_comment_at(const location_tuple& location_info) {
 
     // Write the footer.
     ss << "'}";
-    vimson = ss.str();
-    return vimson.c_str();
+    return ss.str();
 }
 
-const char*
-libclang_vim::get_deduced_declaration_at(const location_tuple& location_info) {
-    static std::string vimson;
+const char* libclang_vim::get_comment_at(const location_tuple& location_info) {
+    return query_translation_unit(
+        location_info, [&](CXTranslationUnit translation_unit) {
+            return get_comment_at(translation_unit, location_info);
+        });
+}
 
+std::string
+libclang_vim::get_deduced_declaration_at(CXTranslationUnit translation_unit,
+                                         const location_tuple& location_info) {
     // Write the header.
     std::stringstream ss;
     ss << "{";
 
     // Write the actual comment.
-    cxindex_ptr index = clang_createIndex(/*excludeDeclarationsFromPCH=*/1,
-                                          /*displayDiagnostics=*/0);
-
     std::string file_name = location_info.file;
-    std::vector<const char*> args_ptrs = get_args_ptrs(location_info.args);
-    std::vector<CXUnsavedFile> unsaved_files =
-        create_unsaved_files(location_info);
-    CXTranslationUnit_Flags flags = CXTranslationUnit_Incomplete;
-    cxtranslation_unit_ptr translation_unit(clang_parseTranslationUnit(
-        index, file_name.c_str(), args_ptrs.data(), args_ptrs.size(),
-        unsaved_files.data(), unsaved_files.size(), flags));
-    if (!translation_unit)
-        return "{}";
 
     CXFile file = clang_getFile(translation_unit, file_name.c_str());
     int line = location_info.line;
@@ -548,30 +572,29 @@ libclang_vim::get_deduced_declaration_at(const location_tuple& location_info) {
 
     // Write the footer.
     ss << "}";
-    vimson = ss.str();
-    return vimson.c_str();
+    return ss.str();
 }
 
-const char* libclang_vim::get_include_at(const location_tuple& location_info) {
-    static std::string vimson;
+const char*
+libclang_vim::get_deduced_declaration_at(const location_tuple& location_info) {
+    return query_translation_unit(
+        location_info, [&](CXTranslationUnit translation_unit) {
+            return get_deduced_declaration_at(translation_unit, location_info);
+        });
+}
 
+const char* libclang_vim::get_include_at(const location_tuple& location_info) {
     // Write the header.
     std::stringstream ss;
     ss << "{'file':'";
 
     // Write the actual comment.
-    cxindex_ptr index = clang_createIndex(/*excludeDeclarationsFromPCH=*/1,
-                                          /*displayDiagnostics=*/0);
-
     std::string file_name = location_info.file;
-    std::vector<const char*> args_ptrs = get_args_ptrs(location_info.args);
-    unsigned options = CXTranslationUnit_Incomplete |
+    // Inclusion directives of a precompiled preamble are not visible.
+    unsigned options = (get_parse_options(location_info) & ~preamble_options) |
                        CXTranslationUnit_DetailedPreprocessingRecord;
-    std::vector<CXUnsavedFile> unsaved_files =
-        create_unsaved_files(location_info);
-    cxtranslation_unit_ptr translation_unit(clang_parseTranslationUnit(
-        index, file_name.c_str(), args_ptrs.data(), args_ptrs.size(),
-        unsaved_files.data(), unsaved_files.size(), options));
+    locked_translation_unit translation_unit =
+        parse_translation_unit(location_info, options);
     if (!translation_unit)
         return "{}";
 
@@ -590,92 +613,73 @@ const char* libclang_vim::get_include_at(const location_tuple& location_info) {
 
     // Write the footer.
     ss << "'}";
-    vimson = ss.str();
-    return vimson.c_str();
+    return store_result(ss.str(), location_info);
+}
+
+std::string
+libclang_vim::get_completion_at(CXTranslationUnit translation_unit,
+                                const location_tuple& location_info) {
+    completion_lookup lookup(location_info);
+    if (!lookup.session)
+        lookup.complete(translation_unit, location_info);
+    return write_completions(*lookup.session, location_info);
 }
 
 const char*
 libclang_vim::get_completion_at(const location_tuple& location_info) {
-    static std::string vimson;
-
-    // Write the header.
-    std::stringstream ss;
-    ss << "['";
-
-    // Write the completion list.
-    libclang_vim::cxindex_ptr index = clang_createIndex(
-        /*excludeDeclarationsFromPCH=*/1, /*displayDiagnostics=*/0);
+    // Typing the same identifier needs no reparse.
+    completion_lookup lookup(location_info);
+    if (!lookup.session) {
+        locked_translation_unit translation_unit =
+            parse_translation_unit(location_info);
+        if (!translation_unit)
+            return "[]";
+        lookup.complete(translation_unit, location_info);
+    }
+    return store_result(write_completions(*lookup.session, location_info),
+                        location_info);
+}
 
-    std::string file_name = location_info.file;
-    std::vector<const char*> args_ptrs = get_args_ptrs(location_info.args);
-    std::vector<CXUnsavedFile> unsaved_files =
-        create_unsaved_files(location_info);
-    unsigned options = CXTranslationUnit_Incomplete;
-    cxtranslation_unit_ptr translation_unit(clang_parseTranslationUnit(
-        index, file_name.c_str(), args_ptrs.data(), args_ptrs.size(),
-        unsaved_files.data(), unsaved_files.size(), options));
-    if (!translation_unit)
-        return "[]";
+std::string
+libclang_vim::get_completion_items_at(CXTranslationUnit translation_unit,
+                                      const location_tuple& location_info) {
+    completion_lookup lookup(location_info);
+    if (!lookup.session)
+        lookup.complete(translation_unit, location_info);
+    return write_completion_items(*lookup.session, location_info);
+}
 
-    unsigned line = location_info.line;
-    unsigned column = location_info.col;
-    CXCodeCompleteResults* results = clang_codeCompleteAt(
-        translation_unit, file_name.c_str(), line, column, unsaved_files.data(),
-        unsaved_files.size(), clang_defaultCodeCompleteOptions());
-    std::set<std::string> matches;
-    if (results) {
-        for (unsigned i = 0; i < results->NumResults; ++i) {
-            const CXCompletionString& completion_string =
-                results->Results[i].CompletionString;
-            std::stringstream match;
-            for (unsigned j = 0;
-                 j < clang_getNumCompletionChunks(completion_string); ++j) {
-                if (clang_getCompletionChunkKind(completion_string, j) !=
-                    CXCompletionChunk_TypedText)
-                    continue;
-
-                const CXString& chunk_text =
-                    clang_getCompletionChunkText(completion_string, j);
-                match << clang_getCString(chunk_text);
-            }
-            matches.insert(match.str());
-        }
-        clang_disposeCodeCompleteResults(results);
-    }
-    for (auto it = matches.begin(); it != matches.end(); ++it) {
-        if (it != matches.begin())
-            ss << "', '";
-        ss << *it;
+const char*
+libclang_vim::get_completion_items_at(const location_tuple& location_info) {
+    completion_lookup lookup(location_info);
+    if (!lookup.session) {
+        locked_translation_unit translation_unit =
+            parse_translation_unit(location_info);
+        if (!translation_unit)
+            return "{}";
+        lookup.complete(translation_unit, location_info);
     }
-
-    // Write the footer.
-    ss << "']";
-    vimson = ss.str();
-    return vimson.c_str();
+    return store_result(write_completion_items(*lookup.session, location_info),
+                        location_info);
 }
 
-const char* libclang_vim::get_diagnostics(const location_tuple& location_info) {
-    static std::string vimson;
+const char* libclang_vim::get_completion_detail(unsigned long session,
+                                                std::size_t index) {
+    auto const found = completion_sessions::instance().find(session);
+    if (!found)
+        return "{}";
+
+    return store_result(write_completion_detail(*found, index));
+}
 
+std::string
+libclang_vim::get_diagnostics(CXTranslationUnit translation_unit,
+                              const location_tuple& /*location_info*/) {
     // Write the header.
     std::stringstream ss;
     ss << "[";
 
     // Write the diagnostic list.
-    libclang_vim::cxindex_ptr index = clang_createIndex(
-        /*excludeDeclarationsFromPCH=*/1, /*displayDiagnostics=*/0);
-
-    std::string file_name = location_info.file;
-    std::vector<const char*> args_ptrs = get_args_ptrs(location_info.args);
-    std::vector<CXUnsavedFile> unsaved_files =
-        create_unsaved_files(location_info);
-    unsigned options = CXTranslationUnit_Incomplete;
-    cxtranslation_unit_ptr translation_unit(clang_parseTranslationUnit(
-        index, file_name.c_str(), args_ptrs.data(), args_ptrs.size(),
-        unsaved_files.data(), unsaved_files.size(), options));
-    if (!translation_unit)
-        return "[]";
-
     unsigned num_diagnostics = clang_getNumDiagnostics(translation_unit);
     for (unsigned i = 0; i < num_diagnostics; ++i) {
         CXDiagnostic diagnostic = clang_getDiagnostic(translation_unit, i);
@@ -715,8 +719,16 @@ const char* libclang_vim::get_diagnostics(const location_tuple& location_info) {
 
     // Write the footer.
     ss << "]";
-    vimson = ss.str();
-    return vimson.c_str();
+    return ss.str();
+}
+
+const char* libclang_vim::get_diagnostics(const location_tuple& location_info) {
+    return query_translation_unit(
+        location_info,
+        [&](CXTranslationUnit translation_unit) {
+            return get_diagnostics(translation_unit, location_info);
+        },
+        "[]");
 }
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
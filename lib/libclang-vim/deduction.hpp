@@ -10,38 +10,79 @@
 
 namespace libclang_vim {
 
+std::string deduce_var_decl_type(CXTranslationUnit translation_unit,
+                                 const location_tuple& location_info);
+
 const char* deduce_var_decl_type(const location_tuple& location_info);
 
+std::string deduce_func_return_type(CXTranslationUnit translation_unit,
+                                    const location_tuple& location_info);
+
 const char* deduce_func_return_type(const location_tuple& location_info);
 
+std::string deduce_func_or_var_decl(CXTranslationUnit translation_unit,
+                                    const location_tuple& location_info);
+
 const char* deduce_func_or_var_decl(const location_tuple& location_info);
 
 /// Get type at specific location with auto-deduction described above.
+std::string deduce_type_at(CXTranslationUnit translation_unit,
+                           const location_tuple& location_info);
+
 const char* deduce_type_at(const location_tuple& location_info);
 
 /// Wrapper around clang_getCursorSpelling() for the current function.
+std::string get_current_function_at(CXTranslationUnit translation_unit,
+                                    const location_tuple& location_info);
+
 const char* get_current_function_at(const location_tuple& location_info);
 
 /// Wrapper around clang_getCursorSpelling() for the referenced (member)
 /// function.
+std::string get_full_name_at(CXTranslationUnit translation_unit,
+                             const location_tuple& location_info);
+
 const char* get_full_name_at(const location_tuple& location_info);
 
 /// Wrapper around clang_Cursor_getBriefCommentText().
+std::string get_comment_at(CXTranslationUnit translation_unit,
+                           const location_tuple& location_info);
+
 const char* get_comment_at(const location_tuple& location_info);
 
 /// Get location of declaration referenced by location_info.
+std::string get_deduced_declaration_at(CXTranslationUnit translation_unit,
+                                       const location_tuple& location_info);
+
 const char* get_deduced_declaration_at(const location_tuple& location_info);
 
 /// Wrapper around clang_getIncludedFile().
 const char* get_include_at(const location_tuple& location_info);
 
 /// Wrapper around clang_codeCompleteAt().
+std::string get_completion_at(CXTranslationUnit translation_unit,
+                              const location_tuple& location_info);
+
 const char* get_completion_at(const location_tuple& location_info);
 
+/// Like get_completion_at(), but writes the session of the completion and the
+/// index, kind and priority of each item, see write_completion_items().
+std::string get_completion_items_at(CXTranslationUnit translation_unit,
+                                    const location_tuple& location_info);
+
+const char* get_completion_items_at(const location_tuple& location_info);
+
+/// Details of the item at index of a get_completion_items_at() result, read
+/// from the kept results of session, {} if the session is not kept any more.
+const char* get_completion_detail(unsigned long session, std::size_t index);
+
 /// Wrapper around clang_CompilationDatabase_getCompileCommands().
-const char* get_compile_commands(const std::string& file);
+const char* get_compile_commands(const location_tuple& location_info);
 
 /// Wrapper around clang_getDiagnostic().
+std::string get_diagnostics(CXTranslationUnit translation_unit,
+                            const location_tuple& location_info);
+
 const char* get_diagnostics(const location_tuple& location_info);
 
 } // namespace libclang_vim
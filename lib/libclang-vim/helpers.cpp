@@ -1,4 +1,16 @@
 #include "helpers.hpp"
+#include "compilation_database.hpp"
+#include "result_arena.hpp"
+#include "translation_unit_cache.hpp"
+#include "unsaved_buffers.hpp"
+
+#include <algorithm>
+#include <cctype>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace {
 
@@ -17,13 +29,82 @@ CXChildVisitResult search_kind_visitor(CXCursor cursor, CXCursor /*unused*/,
     return CXChildVisit_Continue;
 }
 
+const std::string option_prefix = "--vim-clang-";
+
+/// Splits s at whitespace like a shell does, so quotes and backslashes can
+/// keep spaces in an argument, e.g. -DGREETING='"hello world"'.
 libclang_vim::args_type parse_compiler_args(const std::string& s) {
-    using iterator = std::istream_iterator<std::string>;
     libclang_vim::args_type result;
-    std::istringstream iss(s);
-    std::copy(iterator(iss), iterator{}, std::back_inserter(result));
+    std::string arg;
+    bool in_arg = false;
+    char quote = 0;
+    for (std::size_t i = 0; i < s.size(); ++i) {
+        char const c = s[i];
+        if (quote) {
+            if (c == quote)
+                quote = 0;
+            else if (c == '\\' && quote == '"' && i + 1 < s.size() &&
+                     (s[i + 1] == '"' || s[i + 1] == '\\'))
+                arg.push_back(s[++i]);
+            else
+                arg.push_back(c);
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+            in_arg = true;
+        } else if (c == '\\' && i + 1 < s.size()) {
+            arg.push_back(s[++i]);
+            in_arg = true;
+        } else if (std::isspace(static_cast<unsigned char>(c))) {
+            if (in_arg)
+                result.push_back(arg);
+            arg.clear();
+            in_arg = false;
+        } else {
+            arg.push_back(c);
+            in_arg = true;
+        }
+    }
+    if (in_arg)
+        result.push_back(arg);
     return result;
 }
+
+/// Moves --vim-clang-<name>=<value> arguments from info.args to info.options.
+void extract_options(libclang_vim::location_tuple& info) {
+    auto const is_option = [](const std::string& arg) {
+        return arg.compare(0, option_prefix.size(), option_prefix) == 0;
+    };
+    for (const auto& arg : info.args) {
+        if (!is_option(arg))
+            continue;
+
+        std::size_t const pos = arg.find('=');
+        if (pos == std::string::npos)
+            info.options[arg.substr(option_prefix.size())] = "";
+        else
+            info.options[arg.substr(option_prefix.size(),
+                                    pos - option_prefix.size())] =
+                arg.substr(pos + 1);
+    }
+    info.args.erase(
+        std::remove_if(info.args.begin(), info.args.end(), is_option),
+        info.args.end());
+}
+
+/// With --vim-clang-args=auto, puts the arguments of info.file from its
+/// compilation database before the given ones.
+void resolve_compiler_args(libclang_vim::location_tuple& info) {
+    if (libclang_vim::get_option(info, "args") != "auto")
+        return;
+
+    libclang_vim::args_type args;
+    if (!libclang_vim::compilation_database_cache::instance().get_parse_args(
+            info.file, args))
+        return;
+
+    args.insert(args.end(), info.args.begin(), info.args.end());
+    info.args = std::move(args);
+}
 }
 
 size_t libclang_vim::get_file_size(const char* filename) {
@@ -31,12 +112,70 @@ size_t libclang_vim::get_file_size(const char* filename) {
     return input.seekg(0, std::ios::end).tellg();
 }
 
+libclang_vim::file_stamp::file_stamp() = default;
+
+bool libclang_vim::file_stamp::operator==(const file_stamp& other) const {
+    return seconds == other.seconds && nanoseconds == other.nanoseconds &&
+           size == other.size;
+}
+
+bool libclang_vim::file_stamp::operator!=(const file_stamp& other) const {
+    return !(*this == other);
+}
+
+libclang_vim::file_stamp libclang_vim::get_file_stamp(const std::string& file) {
+    file_stamp stamp;
+    struct stat info {};
+    if (stat(file.c_str(), &info) != 0)
+        return stamp;
+
+#if defined __APPLE__
+    stamp.seconds = info.st_mtimespec.tv_sec;
+    stamp.nanoseconds = info.st_mtimespec.tv_nsec;
+#else
+    stamp.seconds = info.st_mtim.tv_sec;
+    stamp.nanoseconds = info.st_mtim.tv_nsec;
+#endif
+    stamp.size = info.st_size;
+    return stamp;
+}
+
+std::string libclang_vim::get_absolute_path(const std::string& file) {
+    if (!file.empty() && file[0] == '/')
+        return file;
+
+    std::vector<char> buffer(4096);
+    if (!getcwd(buffer.data(), buffer.size()))
+        return file;
+    return std::string(buffer.data()) + "/" + file;
+}
+
+std::uint64_t libclang_vim::hash_bytes(const char* data, std::size_t size,
+                                       std::uint64_t hash) {
+    for (const char* it = data; it != data + size; ++it) {
+        hash ^= static_cast<unsigned char>(*it);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
 bool libclang_vim::is_null_location(const CXSourceLocation& location) {
     return clang_equalLocations(location, clang_getNullLocation());
 }
 
 libclang_vim::cxindex_ptr::cxindex_ptr(CXIndex index) : _index(index) {}
 
+libclang_vim::cxindex_ptr& libclang_vim::cxindex_ptr::
+operator=(cxindex_ptr&& other) {
+    if (this != &other) {
+        if (_index)
+            clang_disposeIndex(_index);
+        _index = other._index;
+        other._index = nullptr;
+    }
+    return *this;
+}
+
 libclang_vim::cxindex_ptr::operator const CXIndex&() const { return _index; }
 
 libclang_vim::cxindex_ptr::operator bool() const { return _index != nullptr; }
@@ -50,6 +189,23 @@ libclang_vim::cxtranslation_unit_ptr::cxtranslation_unit_ptr(
     CXTranslationUnit unit)
     : _unit(unit) {}
 
+libclang_vim::cxtranslation_unit_ptr::cxtranslation_unit_ptr(
+    cxtranslation_unit_ptr&& other)
+    : _unit(other._unit) {
+    other._unit = nullptr;
+}
+
+libclang_vim::cxtranslation_unit_ptr& libclang_vim::cxtranslation_unit_ptr::
+operator=(cxtranslation_unit_ptr&& other) {
+    if (this != &other) {
+        if (_unit)
+            clang_disposeTranslationUnit(_unit);
+        _unit = other._unit;
+        other._unit = nullptr;
+    }
+    return *this;
+}
+
 libclang_vim::cxtranslation_unit_ptr::
 operator const CXTranslationUnit&() const {
     return _unit;
@@ -74,21 +230,6 @@ const char* libclang_vim::to_c_str(const libclang_vim::cxstring_ptr& string) {
     return clang_getCString(string);
 }
 
-std::string libclang_vim::stringize_key_value(const char* key_name,
-                                              const cxstring_ptr& p) {
-    const auto* cstring = clang_getCString(p);
-    if (!cstring || std::strcmp(cstring, "") == 0)
-        return "";
-    return "'" + std::string{key_name} + "':'" + cstring + "',";
-}
-
-std::string libclang_vim::stringize_key_value(const char* key_name,
-                                              const std::string& s) {
-    if (s.empty())
-        return "";
-    return "'" + (key_name + ("':'" + s + "',"));
-}
-
 bool libclang_vim::is_class_decl_kind(const CXCursorKind& kind) {
     switch (kind) {
     case CXCursor_StructDecl:
@@ -156,37 +297,100 @@ libclang_vim::parse_default_args(const std::string& args_string) {
     if (path_end + 1 == end)
         return info;
     info.args = parse_compiler_args({path_end + 1, end});
+    extract_options(info);
+    resolve_compiler_args(info);
     return info;
 }
 
+libclang_vim::unsaved_contents::unsaved_contents(std::vector<char> contents)
+    : _owned(std::move(contents)), _data(_owned.data()),
+      _size(_owned.size()) {}
+
+libclang_vim::unsaved_contents::unsaved_contents(void* mapping,
+                                                 std::size_t size)
+    : _mapping(mapping), _data(static_cast<const char*>(mapping)),
+      _size(size) {}
+
+libclang_vim::unsaved_contents::~unsaved_contents() {
+    if (_mapping)
+        munmap(_mapping, _size);
+}
+
+const char* libclang_vim::unsaved_contents::data() const { return _data; }
+
+std::size_t libclang_vim::unsaved_contents::size() const { return _size; }
+
+bool libclang_vim::unsaved_contents::is_mapped() const {
+    return _mapping != nullptr;
+}
+
+libclang_vim::unsaved_contents_ptr
+libclang_vim::map_unsaved_file(const std::string& file) {
+    int const fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+
+    struct stat status;
+    void* mapping = MAP_FAILED;
+    if (fstat(fd, &status) == 0 && status.st_size > 0)
+        mapping = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping stays valid after the file is closed.
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return nullptr;
+
+    return std::make_shared<const unsaved_contents>(mapping, status.st_size);
+}
+
 libclang_vim::location_tuple::location_tuple() = default;
 
+std::string libclang_vim::get_option(const location_tuple& location_info,
+                                     const std::string& name,
+                                     const std::string& default_value) {
+    auto const it = location_info.options.find(name);
+    if (it == location_info.options.end())
+        return default_value;
+    return it->second;
+}
+
 std::vector<CXUnsavedFile>
 libclang_vim::create_unsaved_files(const location_tuple& location_info) {
     std::vector<CXUnsavedFile> unsaved_files;
-    if (!location_info.unsaved_file.empty()) {
+    if (location_info.unsaved_file) {
         CXUnsavedFile unsaved_file{};
         unsaved_file.Filename = location_info.file.c_str();
-        unsaved_file.Contents = location_info.unsaved_file.data();
-        unsaved_file.Length = location_info.unsaved_file.size();
+        unsaved_file.Contents = location_info.unsaved_file->data();
+        unsaved_file.Length = location_info.unsaved_file->size();
         unsaved_files.push_back(unsaved_file);
     }
     return unsaved_files;
 }
 
+std::vector<char>
+libclang_vim::get_file_contents(const location_tuple& location_info) {
+    if (location_info.unsaved_file)
+        return std::vector<char>(location_info.unsaved_file->data(),
+                                 location_info.unsaved_file->data() +
+                                     location_info.unsaved_file->size());
+
+    std::ifstream stream(location_info.file.c_str(), std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(stream),
+                             std::istreambuf_iterator<char>());
+}
+
 void libclang_vim::extract_unsaved_file(libclang_vim::location_tuple& info) {
     // Recognize "real filename#temp file" syntax, in which case assume the
     // later is the unsaved version of the previous.
     std::size_t pos = info.file.find('#');
     if (pos != std::string::npos) {
-        std::string unsaved_path = info.file.substr(pos + 1);
+        info.unsaved_file = map_unsaved_file(info.file.substr(pos + 1));
         info.file = info.file.substr(0, pos);
-        std::ifstream unsaved_stream(unsaved_path,
-                                     std::ios::in | std::ios::binary);
-        info.unsaved_file =
-            std::vector<char>((std::istreambuf_iterator<char>(unsaved_stream)),
-                              std::istreambuf_iterator<char>());
+        return;
     }
+
+    // Otherwise use the contents from vim_clang_update_buffer(), if any.
+    info.unsaved_file =
+        unsaved_buffers::instance().get(get_absolute_path(info.file));
 }
 
 libclang_vim::location_tuple
@@ -202,12 +406,6 @@ libclang_vim::parse_args_with_location(const std::string& args_string) {
         return location_tuple();
     }
 
-    auto const default_args =
-        parse_default_args({std::begin(args_string), second_colon});
-    if (default_args.file.empty()) {
-        return location_tuple();
-    }
-
     size_t line, col;
     auto const num_input = std::sscanf(
         std::string{second_colon + 1, end}.c_str(), "%zu:%zu", &line, &col);
@@ -215,15 +413,76 @@ libclang_vim::parse_args_with_location(const std::string& args_string) {
         return location_tuple();
     }
 
-    location_tuple ret;
-    ret.file = default_args.file;
-    ret.unsaved_file = default_args.unsaved_file;
-    ret.args = default_args.args;
+    // Filled in place, so that the unsaved file is not copied.
+    location_tuple ret =
+        parse_default_args({std::begin(args_string), second_colon});
+    if (ret.file.empty()) {
+        return location_tuple();
+    }
+
     ret.line = line;
     ret.col = col;
     return ret;
 }
 
+libclang_vim::batch_query::batch_query() = default;
+
+libclang_vim::location_tuple
+libclang_vim::parse_batch_args(const std::string& args_string,
+                               std::vector<batch_query>& queries) {
+    auto const end = std::end(args_string);
+
+    auto second_colon = std::find(std::begin(args_string), end, ':');
+    if (second_colon == end || second_colon + 1 == end) {
+        return location_tuple();
+    }
+    second_colon = std::find(second_colon + 1, end, ':');
+    if (second_colon == end || second_colon + 1 == end) {
+        return location_tuple();
+    }
+
+    auto const default_args =
+        parse_default_args({std::begin(args_string), second_colon});
+    if (default_args.file.empty()) {
+        return location_tuple();
+    }
+
+    std::stringstream stream(std::string{second_colon + 1, end});
+    std::string query_string;
+    while (std::getline(stream, query_string, ';')) {
+        auto const api_end = query_string.find(':');
+        if (api_end == std::string::npos)
+            continue;
+
+        batch_query query;
+        query.api = query_string.substr(0, api_end);
+        if (std::sscanf(query_string.c_str() + api_end + 1, "%zu:%zu",
+                        &query.line, &query.col) != 2)
+            continue;
+        queries.push_back(query);
+    }
+
+    return default_args;
+}
+
+libclang_vim::location_tuple
+libclang_vim::parse_query_args(const std::string& args_string,
+                               std::string& expression) {
+    auto const end = std::end(args_string);
+
+    auto second_colon = std::find(std::begin(args_string), end, ':');
+    if (second_colon == end) {
+        return location_tuple();
+    }
+    second_colon = std::find(second_colon + 1, end, ':');
+    if (second_colon == end) {
+        return location_tuple();
+    }
+
+    expression.assign(second_colon + 1, end);
+    return parse_default_args({std::begin(args_string), second_colon});
+}
+
 std::vector<const char*> libclang_vim::get_args_ptrs(const args_type& args) {
     std::vector<const char*> args_ptrs{args.size()};
     std::transform(std::begin(args), std::end(args), std::begin(args_ptrs),
@@ -231,32 +490,60 @@ std::vector<const char*> libclang_vim::get_args_ptrs(const args_type& args) {
     return args_ptrs;
 }
 
-const char* libclang_vim::at_specific_location(
-    const location_tuple& location_tuple,
+std::string libclang_vim::join_compiler_args(const args_type& args) {
+    std::string joined;
+    for (const auto& arg : args) {
+        if (!joined.empty())
+            joined.push_back(' ');
+
+        bool const plain =
+            !arg.empty() &&
+            std::none_of(arg.begin(), arg.end(), [](char c) {
+                return c == '\'' || c == '"' || c == '\\' ||
+                       std::isspace(static_cast<unsigned char>(c));
+            });
+        if (plain) {
+            joined += arg;
+            continue;
+        }
+
+        // Single quotes keep everything but themselves, which are written as
+        // '\''.
+        joined.push_back('\'');
+        for (char c : arg) {
+            if (c == '\'')
+                joined += "'\\''";
+            else
+                joined.push_back(c);
+        }
+        joined.push_back('\'');
+    }
+    return joined;
+}
+
+std::string libclang_vim::at_specific_location(
+    CXTranslationUnit translation_unit, const location_tuple& location_tuple,
     const std::function<std::string(CXCursor const&)>& predicate) {
-    static std::string vimson;
     char const* file_name = location_tuple.file.c_str();
-    auto const args_ptrs = get_args_ptrs(location_tuple.args);
-
-    cxindex_ptr index =
-        clang_createIndex(/*excludeDeclsFromPCH*/ 1, /*displayDiagnostics*/ 0);
-    std::vector<CXUnsavedFile> unsaved_files =
-        create_unsaved_files(location_tuple);
-    cxtranslation_unit_ptr translation_unit(clang_parseTranslationUnit(
-        index, file_name, args_ptrs.data(), args_ptrs.size(),
-        unsaved_files.data(), unsaved_files.size(),
-        CXTranslationUnit_Incomplete));
-    if (!translation_unit)
-        return "{}";
 
     CXFile file = clang_getFile(translation_unit, file_name);
     auto const location = clang_getLocation(
         translation_unit, file, location_tuple.line, location_tuple.col);
     CXCursor const cursor = clang_getCursor(translation_unit, location);
 
-    vimson = predicate(cursor);
+    return predicate(cursor);
+}
+
+const char* libclang_vim::query_translation_unit(
+    const location_tuple& location_info,
+    const std::function<std::string(CXTranslationUnit)>& query,
+    const char* failure) {
+    locked_translation_unit translation_unit =
+        parse_translation_unit(location_info);
+    if (!translation_unit)
+        return failure;
 
-    return vimson.c_str();
+    return store_result(query(translation_unit), location_info);
 }
 
 CXCursor libclang_vim::search_kind(
@@ -3,10 +3,13 @@
 
 #include <algorithm>
 #include <cstddef>
+#include <cstdint>
 #include <cstring>
+#include <ctime>
 #include <fstream>
 #include <functional>
 #include <iterator>
+#include <map>
 #include <memory>
 #include <sstream>
 #include <string>
@@ -21,8 +24,33 @@ using std::size_t;
 
 size_t get_file_size(const char* filename);
 
+/// What tells if a file changed: its modification time, with nanoseconds, as
+/// saving twice in a second is common, and its size. All zero if the file is
+/// missing.
+class file_stamp {
+  public:
+    std::time_t seconds = 0;
+    long nanoseconds = 0;
+    std::uint64_t size = 0;
+
+    file_stamp();
+
+    bool operator==(const file_stamp& other) const;
+    bool operator!=(const file_stamp& other) const;
+};
+
+file_stamp get_file_stamp(const std::string& file);
+
+/// Relative file names are only unique together with the working directory.
+std::string get_absolute_path(const std::string& file);
+
 bool is_null_location(const CXSourceLocation& location);
 
+/// FNV-1a hash of size bytes at data, to notice changes without keeping a
+/// copy. Continues from hash, so that pieces can be hashed one by one.
+std::uint64_t hash_bytes(const char* data, std::size_t size,
+                         std::uint64_t hash = 14695981039346656037ULL);
+
 /// Class to avoid the need to call clang_disposeIndex() manually.
 class cxindex_ptr {
     CXIndex _index;
@@ -30,6 +58,12 @@ class cxindex_ptr {
   public:
     cxindex_ptr(CXIndex index);
 
+    cxindex_ptr(const cxindex_ptr&) = delete;
+
+    cxindex_ptr& operator=(const cxindex_ptr&) = delete;
+
+    cxindex_ptr& operator=(cxindex_ptr&& other);
+
     operator const CXIndex&() const;
 
     operator bool() const;
@@ -44,6 +78,14 @@ class cxtranslation_unit_ptr {
   public:
     cxtranslation_unit_ptr(CXTranslationUnit unit);
 
+    cxtranslation_unit_ptr(cxtranslation_unit_ptr&& other);
+
+    cxtranslation_unit_ptr(const cxtranslation_unit_ptr&) = delete;
+
+    cxtranslation_unit_ptr& operator=(const cxtranslation_unit_ptr&) = delete;
+
+    cxtranslation_unit_ptr& operator=(cxtranslation_unit_ptr&& other);
+
     operator const CXTranslationUnit&() const;
 
     operator bool() const;
@@ -65,10 +107,6 @@ class cxstring_ptr {
 
 const char* to_c_str(const cxstring_ptr& string);
 
-std::string stringize_key_value(const char* key_name, const cxstring_ptr& p);
-
-std::string stringize_key_value(const char* key_name, const std::string& s);
-
 bool is_class_decl_kind(const CXCursorKind& kind);
 
 bool is_class_decl(const CXCursor& cursor);
@@ -83,19 +121,64 @@ bool is_parameter(const CXCursor& cursor);
 
 using args_type = std::vector<std::string>;
 
+using options_type = std::map<std::string, std::string>;
+
+/// Read-only contents of an unsaved buffer, either owned or mapped from a
+/// temp file. Shared between copies of location_tuple instead of copied.
+class unsaved_contents {
+    std::vector<char> _owned;
+    /// Set if the contents are mapped.
+    void* _mapping = nullptr;
+    const char* _data = nullptr;
+    std::size_t _size = 0;
+
+  public:
+    explicit unsaved_contents(std::vector<char> contents);
+
+    /// Takes ownership of a mapping created by mmap().
+    unsaved_contents(void* mapping, std::size_t size);
+
+    unsaved_contents(const unsaved_contents&) = delete;
+    unsaved_contents& operator=(const unsaved_contents&) = delete;
+
+    ~unsaved_contents();
+
+    const char* data() const;
+
+    std::size_t size() const;
+
+    /// Mapped contents change if the temp file is rewritten, so they are only
+    /// safe to use during the call which mapped them.
+    bool is_mapped() const;
+};
+
+using unsaved_contents_ptr = std::shared_ptr<const unsaved_contents>;
+
+/// Maps file read-only, returns nullptr if it's empty or can't be mapped.
+unsaved_contents_ptr map_unsaved_file(const std::string& file);
+
 /// Stores compiler arguments with location.
 class location_tuple {
   public:
     std::string file;
-    /// Contents of the unsaved buffer of file.
-    std::vector<char> unsaved_file;
+    /// Contents of the unsaved buffer of file, nullptr if there is none.
+    unsaved_contents_ptr unsaved_file;
     args_type args;
+    /// Options of libclang-vim itself, given as --vim-clang-<name>=<value>
+    /// among the compiler arguments.
+    options_type options;
     size_t line = 0;
     size_t col = 0;
 
     location_tuple();
 };
 
+/// Returns the value of a --vim-clang-<name>=<value> option, or default_value
+/// if it was not given.
+std::string get_option(const location_tuple& location_info,
+                       const std::string& name,
+                       const std::string& default_value = std::string());
+
 /// Parse "file:args".
 location_tuple parse_default_args(const std::string& args_string);
 
@@ -103,18 +186,54 @@ location_tuple parse_default_args(const std::string& args_string);
 std::vector<CXUnsavedFile>
 create_unsaved_files(const location_tuple& location_info);
 
-/// Set info.unsaved_file if info.file is in "real filename#temp file" syntax.
+/// Contents of the unsaved buffer of location_info, or of the file itself.
+std::vector<char> get_file_contents(const location_tuple& location_info);
+
+/// Set info.unsaved_file if info.file is in "real filename#temp file" syntax,
+/// or if the contents of info.file are in unsaved_buffers.
 void extract_unsaved_file(libclang_vim::location_tuple& info);
 
 /// Parse "file:args:line:col".
 location_tuple parse_args_with_location(const std::string& args_string);
 
+/// One query of vim_clang_batch(): the name of a location API and the
+/// location to ask it about.
+class batch_query {
+  public:
+    std::string api;
+    size_t line = 0;
+    size_t col = 0;
+
+    batch_query();
+};
+
+/// Parse "file:args:api:line:col;api:line:col;...".
+location_tuple parse_batch_args(const std::string& args_string,
+                                std::vector<batch_query>& queries);
+
+/// Parse "file:args:expression", the expression may contain colons.
+location_tuple parse_query_args(const std::string& args_string,
+                                std::string& expression);
+
 std::vector<const char*> get_args_ptrs(const args_type& args);
 
-const char* at_specific_location(
-    const location_tuple& location_tuple,
+/// Joins args with spaces, quoting them like a shell does, so that splitting
+/// the result as compiler args gives args again.
+std::string join_compiler_args(const args_type& args);
+
+/// Calls predicate with the cursor at the location of location_tuple.
+std::string at_specific_location(
+    CXTranslationUnit translation_unit, const location_tuple& location_tuple,
     const std::function<std::string(CXCursor const&)>& predicate);
 
+/// Parses location_info and answers query on its translation unit, returns
+/// failure if the file can't be parsed. The result is owned by the
+/// result_arena of the calling thread.
+const char* query_translation_unit(
+    const location_tuple& location_info,
+    const std::function<std::string(CXTranslationUnit)>& query,
+    const char* failure = "{}");
+
 CXCursor search_kind(const CXCursor& cursor,
                      const std::function<bool(const CXCursorKind&)>& predicate);
 
@@ -1,4 +1,5 @@
 #include "location.hpp"
+#include "translation_unit_cache.hpp"
 
 namespace {
 
@@ -14,39 +15,65 @@ CXCursor search_AST_upward(CXCursor cursor,
 }
 }
 
-const char*
-libclang_vim::get_extent(const libclang_vim::location_tuple& location_info,
+std::string
+libclang_vim::get_extent(CXTranslationUnit translation_unit,
+                         const libclang_vim::location_tuple& location_info,
                          const std::function<unsigned(CXCursor)>& predicate) {
     return at_specific_location(
-        location_info, [&predicate](const CXCursor& c) -> std::string {
+        translation_unit, location_info,
+        [&predicate](const CXCursor& c) -> std::string {
             const CXCursor rc = search_AST_upward(c, predicate);
             if (clang_Cursor_isNull(rc)) {
                 return "{}";
             }
             return "{" + stringize_extent(rc) + "}";
         });
-};
+}
 
-const char* libclang_vim::get_related_node_of(
+const char*
+libclang_vim::get_extent(const libclang_vim::location_tuple& location_info,
+                         const std::function<unsigned(CXCursor)>& predicate) {
+    return query_translation_unit(
+        location_info, [&](CXTranslationUnit translation_unit) {
+            return get_extent(translation_unit, location_info, predicate);
+        });
+}
+
+std::string libclang_vim::get_related_node_of(
+    CXTranslationUnit translation_unit,
     const libclang_vim::location_tuple& location_info,
     const std::function<CXCursor(CXCursor)>& predicate) {
     return at_specific_location(
-        location_info, [&predicate](CXCursor const& c) -> std::string {
+        translation_unit, location_info,
+        [&predicate, &location_info](CXCursor const& c) -> std::string {
             CXCursor const rc = predicate(c);
             if (clang_isInvalid(clang_getCursorKind(rc))) {
                 return "{}";
             }
             return "{" +
-                   stringize_cursor(rc, clang_getCursorSemanticParent(rc)) +
+                   stringize_cursor(rc, clang_getCursorSemanticParent(rc),
+                                    get_cursor_fields(location_info)) +
                    "}";
         });
 }
 
-const char* libclang_vim::get_type_related_to(
+const char* libclang_vim::get_related_node_of(
+    const libclang_vim::location_tuple& location_info,
+    const std::function<CXCursor(CXCursor)>& predicate) {
+    return query_translation_unit(
+        location_info, [&](CXTranslationUnit translation_unit) {
+            return get_related_node_of(translation_unit, location_info,
+                                       predicate);
+        });
+}
+
+std::string libclang_vim::get_type_related_to(
+    CXTranslationUnit translation_unit,
     const libclang_vim::location_tuple& location_info,
     const std::function<CXType(CXType)>& predicate) {
     return at_specific_location(
-        location_info, [&predicate](CXCursor const& c) -> std::string {
+        translation_unit, location_info,
+        [&predicate](CXCursor const& c) -> std::string {
             CXType const type = predicate(clang_getCursorType(c));
             if (type.kind == CXType_Invalid) {
                 return "{}";
@@ -55,24 +82,22 @@ const char* libclang_vim::get_type_related_to(
         });
 }
 
-const char* libclang_vim::get_all_extents(
+const char* libclang_vim::get_type_related_to(
+    const libclang_vim::location_tuple& location_info,
+    const std::function<CXType(CXType)>& predicate) {
+    return query_translation_unit(
+        location_info, [&](CXTranslationUnit translation_unit) {
+            return get_type_related_to(translation_unit, location_info,
+                                       predicate);
+        });
+}
+
+std::string libclang_vim::get_all_extents(
+    CXTranslationUnit translation_unit,
     const libclang_vim::location_tuple& location_info) {
-    static std::string vimson;
-    vimson = "";
+    std::string vimson;
     char const* file_name = location_info.file.c_str();
 
-    cxindex_ptr index =
-        clang_createIndex(/*excludeDeclsFromPCH*/ 1, /*displayDiagnostics*/ 0);
-    auto const args_ptrs = get_args_ptrs(location_info.args);
-    std::vector<CXUnsavedFile> unsaved_files =
-        create_unsaved_files(location_info);
-    unsigned options = CXTranslationUnit_Incomplete;
-    cxtranslation_unit_ptr translation_unit(clang_parseTranslationUnit(
-        index, file_name, args_ptrs.data(), args_ptrs.size(),
-        unsaved_files.data(), unsaved_files.size(), options));
-    if (!translation_unit)
-        return "[]";
-
     CXFile file = clang_getFile(translation_unit, file_name);
     auto const location = clang_getLocation(
         translation_unit, file, location_info.line, location_info.col);
@@ -92,9 +117,17 @@ const char* libclang_vim::get_all_extents(
         cursor = clang_getCursorSemanticParent(cursor);
     }
 
-    vimson = "[" + vimson + "]";
+    return "[" + vimson + "]";
+}
 
-    return vimson.c_str();
+const char* libclang_vim::get_all_extents(
+    const libclang_vim::location_tuple& location_info) {
+    return query_translation_unit(
+        location_info,
+        [&](CXTranslationUnit translation_unit) {
+            return get_all_extents(translation_unit, location_info);
+        },
+        "[]");
 }
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
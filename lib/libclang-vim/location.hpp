@@ -12,16 +12,33 @@
 
 namespace libclang_vim {
 
+/// Extent of the innermost cursor around location_info matching predicate.
+std::string get_extent(CXTranslationUnit translation_unit,
+                       const location_tuple& location_info,
+                       const std::function<unsigned(CXCursor)>& predicate);
+
 const char* get_extent(const location_tuple& location_info,
                        const std::function<unsigned(CXCursor)>& predicate);
 
+std::string
+get_related_node_of(CXTranslationUnit translation_unit,
+                    const location_tuple& location_info,
+                    const std::function<CXCursor(CXCursor)>& predicate);
+
 const char*
 get_related_node_of(const location_tuple& location_info,
                     const std::function<CXCursor(CXCursor)>& predicate);
 
+std::string get_type_related_to(CXTranslationUnit translation_unit,
+                                const location_tuple& location_info,
+                                const std::function<CXType(CXType)>& predicate);
+
 const char* get_type_related_to(const location_tuple& location_info,
                                 const std::function<CXType(CXType)>& predicate);
 
+std::string get_all_extents(CXTranslationUnit translation_unit,
+                            const location_tuple& location_info);
+
 const char* get_all_extents(const location_tuple& location_info);
 
 } // namespace libclang_vim
@@ -0,0 +1,93 @@
+#include "parse_queue.hpp"
+#include "translation_unit_cache.hpp"
+
+libclang_vim::parse_queue::parse_queue() {
+    // Statics are destroyed in reverse order of construction: this makes the
+    // cache outlive the queue, so the destructor can join a worker which is
+    // in the middle of a parse.
+    translation_unit_cache::instance();
+}
+
+libclang_vim::parse_queue::~parse_queue() { stop(); }
+
+libclang_vim::parse_queue& libclang_vim::parse_queue::instance() {
+    static parse_queue queue;
+    return queue;
+}
+
+void libclang_vim::parse_queue::run() {
+    while (true) {
+        std::pair<unsigned long, location_tuple> request;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _condition.wait(lock,
+                            [this] { return _stopping || !_requests.empty(); });
+            if (_stopping)
+                return;
+
+            request = std::move(_requests.front());
+            _requests.pop_front();
+        }
+
+        bool const parsed = parse_translation_unit(request.second) != nullptr;
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        // Tickets are dropped by stop().
+        if (!_stopping)
+            _statuses[request.first] = parsed ? status::ready : status::failed;
+    }
+}
+
+unsigned long
+libclang_vim::parse_queue::enqueue(const location_tuple& location_info) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    unsigned long const ticket = ++_last_ticket;
+    if (_stopping) {
+        // The worker is about to exit.
+        _statuses[ticket] = status::failed;
+        return ticket;
+    }
+
+    if (!_worker.joinable())
+        _worker = std::thread(&parse_queue::run, this);
+
+    _requests.emplace_back(ticket, location_info);
+    // The temp file may be rewritten before the request is parsed.
+    auto& unsaved_file = _requests.back().second.unsaved_file;
+    if (unsaved_file && unsaved_file->is_mapped())
+        unsaved_file = std::make_shared<const unsaved_contents>(
+            std::vector<char>(unsaved_file->data(),
+                              unsaved_file->data() + unsaved_file->size()));
+    _statuses[ticket] = status::pending;
+    _condition.notify_one();
+    return ticket;
+}
+
+bool libclang_vim::parse_queue::poll(unsigned long ticket, status& result) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _statuses.find(ticket);
+    if (it == _statuses.end())
+        return false;
+
+    result = it->second;
+    if (result != status::pending)
+        _statuses.erase(it);
+    return true;
+}
+
+void libclang_vim::parse_queue::stop() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+        _requests.clear();
+        _statuses.clear();
+    }
+    _condition.notify_all();
+    if (_worker.joinable())
+        _worker.join();
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stopping = false;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,64 @@
+#if !defined LIBCLANG_VIM_PARSE_QUEUE_HPP_INCLUDED
+#define LIBCLANG_VIM_PARSE_QUEUE_HPP_INCLUDED
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "helpers.hpp"
+
+namespace libclang_vim {
+
+/// Parses translation units into translation_unit_cache on a worker thread,
+/// so that the caller doesn't have to wait for clang_parseTranslationUnit().
+class parse_queue {
+  public:
+    enum struct status {
+        pending = 0,
+        ready,
+        failed,
+    };
+
+  private:
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    std::deque<std::pair<unsigned long, location_tuple>> _requests;
+    /// Tickets which are not polled as finished yet.
+    std::map<unsigned long, status> _statuses;
+    unsigned long _last_ticket = 0;
+    bool _stopping = false;
+    std::thread _worker;
+
+    parse_queue();
+
+    void run();
+
+  public:
+    parse_queue(const parse_queue&) = delete;
+    parse_queue& operator=(const parse_queue&) = delete;
+
+    /// Waits for the current parse, drops the pending ones.
+    ~parse_queue();
+
+    static parse_queue& instance();
+
+    /// Schedules a parse of location_info, returns its ticket.
+    unsigned long enqueue(const location_tuple& location_info);
+
+    /// Gets the status of ticket, a finished ticket is forgotten after this.
+    /// Returns false for an unknown ticket.
+    bool poll(unsigned long ticket, status& result);
+
+    /// Drops the pending parses and all tickets, waits for the current parse
+    /// and stops the worker thread. The next enqueue() starts it again.
+    void stop();
+};
+
+} // namespace libclang_vim
+
+#endif // LIBCLANG_VIM_PARSE_QUEUE_HPP_INCLUDED
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
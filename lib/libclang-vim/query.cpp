@@ -0,0 +1,325 @@
+#include "query.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <regex>
+#include <set>
+
+namespace {
+
+using predicate_type = std::function<bool(const CXCursor&)>;
+
+/// A compiled subexpression.
+class term {
+  public:
+    predicate_type predicate;
+    /// Flags (or negated flags, like "!in_system_header") which hold for all
+    /// the matches of the term.
+    std::set<std::string> required;
+    /// Name of the flag if the term is a single one.
+    std::string flag;
+
+    term();
+};
+
+term::term() = default;
+
+predicate_type kind_predicate(unsigned (*is_kind)(CXCursorKind)) {
+    return [is_kind](const CXCursor& cursor) {
+        return is_kind(clang_getCursorKind(cursor)) != 0;
+    };
+}
+
+predicate_type cursor_predicate(unsigned (*is_true)(CXCursor)) {
+    return [is_true](const CXCursor& cursor) { return is_true(cursor) != 0; };
+}
+
+predicate_type location_predicate(int (*is_true)(CXSourceLocation)) {
+    return [is_true](const CXCursor& cursor) {
+        return is_true(clang_getCursorLocation(cursor)) != 0;
+    };
+}
+
+/// Atoms without a value.
+const std::map<std::string, predicate_type>& get_flags() {
+    static const std::map<std::string, predicate_type> flags{
+        {"declaration", kind_predicate(clang_isDeclaration)},
+        {"reference", kind_predicate(clang_isReference)},
+        {"expression", kind_predicate(clang_isExpression)},
+        {"statement", kind_predicate(clang_isStatement)},
+        {"attribute", kind_predicate(clang_isAttribute)},
+        {"translation_unit", kind_predicate(clang_isTranslationUnit)},
+        {"preprocessing", kind_predicate(clang_isPreprocessing)},
+        {"unexposed", kind_predicate(clang_isUnexposed)},
+        {"is_definition", cursor_predicate(clang_isCursorDefinition)},
+        {"is_virtual", cursor_predicate(clang_CXXMethod_isVirtual)},
+        {"is_pure_virtual", cursor_predicate(clang_CXXMethod_isPureVirtual)},
+        {"is_static", cursor_predicate(clang_CXXMethod_isStatic)},
+        {"in_main_file", location_predicate(clang_Location_isFromMainFile)},
+        {"in_system_header",
+         location_predicate(clang_Location_isInSystemHeader)},
+    };
+    return flags;
+}
+
+std::set<std::string> intersect(const std::set<std::string>& a,
+                                const std::set<std::string>& b) {
+    std::set<std::string> result;
+    std::set_intersection(a.begin(), a.end(), b.begin(), b.end(),
+                          std::inserter(result, result.end()));
+    return result;
+}
+
+/// Recursive descent parser of the grammar:
+///
+/// or    := and ('||' and)*
+/// and   := unary ('&&' unary)*
+/// unary := '!' unary | '(' or ')' | atom
+/// atom  := flag | 'name=' value | 'name=~' value | 'kind=' value |
+///          'access=' value
+/// value := word | "'" characters, '' for a quote "'"
+class query_parser {
+    const std::string& _text;
+    std::size_t _pos = 0;
+    bool _valid = true;
+
+    void skip_spaces();
+    /// Consumes token if the text continues with it.
+    bool accept(const char* token);
+    bool read_word(std::string& word);
+    bool read_value(std::string& value);
+    /// Marks the expression invalid, the returned term matches nothing.
+    term fail();
+
+    term parse_or();
+    term parse_and();
+    term parse_unary();
+    term parse_atom();
+
+  public:
+    explicit query_parser(const std::string& text);
+
+    /// Returns false if text is not a valid expression.
+    bool parse(term& result);
+};
+
+query_parser::query_parser(const std::string& text) : _text(text) {}
+
+void query_parser::skip_spaces() {
+    while (_pos < _text.size() && _text[_pos] == ' ')
+        ++_pos;
+}
+
+bool query_parser::accept(const char* token) {
+    skip_spaces();
+    std::size_t const length = std::strlen(token);
+    if (_text.compare(_pos, length, token) != 0)
+        return false;
+    _pos += length;
+    return true;
+}
+
+bool query_parser::read_word(std::string& word) {
+    skip_spaces();
+    std::size_t const begin = _pos;
+    while (_pos < _text.size() &&
+           (std::islower(static_cast<unsigned char>(_text[_pos])) ||
+            _text[_pos] == '_'))
+        ++_pos;
+    word = _text.substr(begin, _pos - begin);
+    return !word.empty();
+}
+
+bool query_parser::read_value(std::string& value) {
+    value.clear();
+    if (_pos < _text.size() && _text[_pos] == '\'') {
+        for (++_pos; _pos < _text.size(); ++_pos) {
+            if (_text[_pos] == '\'') {
+                if (_pos + 1 < _text.size() && _text[_pos + 1] == '\'') {
+                    value.push_back('\'');
+                    ++_pos;
+                    continue;
+                }
+                ++_pos;
+                return true;
+            }
+            value.push_back(_text[_pos]);
+        }
+        // No closing quote.
+        return false;
+    }
+
+    while (_pos < _text.size() && std::strchr(" ()&|", _text[_pos]) == nullptr)
+        value.push_back(_text[_pos++]);
+    return !value.empty();
+}
+
+term query_parser::fail() {
+    _valid = false;
+    term result;
+    result.predicate = [](const CXCursor&) { return false; };
+    return result;
+}
+
+term query_parser::parse_or() {
+    term result = parse_and();
+    while (_valid && accept("||")) {
+        term const right = parse_and();
+        predicate_type const left = result.predicate;
+        result.predicate = [left, right](const CXCursor& cursor) {
+            return left(cursor) || right.predicate(cursor);
+        };
+        result.required = intersect(result.required, right.required);
+        result.flag.clear();
+    }
+    return result;
+}
+
+term query_parser::parse_and() {
+    term result = parse_unary();
+    while (_valid && accept("&&")) {
+        term const right = parse_unary();
+        predicate_type const left = result.predicate;
+        result.predicate = [left, right](const CXCursor& cursor) {
+            return left(cursor) && right.predicate(cursor);
+        };
+        result.required.insert(right.required.begin(), right.required.end());
+        result.flag.clear();
+    }
+    return result;
+}
+
+term query_parser::parse_unary() {
+    if (accept("!")) {
+        term const operand = parse_unary();
+        term result;
+        predicate_type const negated = operand.predicate;
+        result.predicate = [negated](const CXCursor& cursor) {
+            return !negated(cursor);
+        };
+        if (!operand.flag.empty())
+            result.required.insert("!" + operand.flag);
+        return result;
+    }
+
+    if (accept("(")) {
+        term result = parse_or();
+        if (!accept(")"))
+            return fail();
+        result.flag.clear();
+        return result;
+    }
+
+    return parse_atom();
+}
+
+term query_parser::parse_atom() {
+    std::string name;
+    if (!read_word(name))
+        return fail();
+
+    term result;
+    std::string value;
+    if (accept("=~")) {
+        if (name != "name" || !read_value(value))
+            return fail();
+
+        std::regex regex;
+        try {
+            regex.assign(value);
+        } catch (const std::regex_error&) {
+            return fail();
+        }
+        result.predicate = [regex](const CXCursor& cursor) {
+            libclang_vim::cxstring_ptr spelling =
+                clang_getCursorSpelling(cursor);
+            const char* name = libclang_vim::to_c_str(spelling);
+            return name && std::regex_search(name, regex);
+        };
+        return result;
+    }
+
+    if (accept("=")) {
+        if (!read_value(value))
+            return fail();
+
+        if (name == "name") {
+            result.predicate = [value](const CXCursor& cursor) {
+                libclang_vim::cxstring_ptr spelling =
+                    clang_getCursorSpelling(cursor);
+                const char* name = libclang_vim::to_c_str(spelling);
+                return name && value == name;
+            };
+        } else if (name == "kind") {
+            result.predicate = [value](const CXCursor& cursor) {
+                libclang_vim::cxstring_ptr spelling =
+                    clang_getCursorKindSpelling(clang_getCursorKind(cursor));
+                return value == libclang_vim::to_c_str(spelling);
+            };
+        } else if (name == "access") {
+            static const std::map<std::string, CX_CXXAccessSpecifier>
+                specifiers{{"public", CX_CXXPublic},
+                           {"protected", CX_CXXProtected},
+                           {"private", CX_CXXPrivate}};
+            auto const it = specifiers.find(value);
+            if (it == specifiers.end())
+                return fail();
+            CX_CXXAccessSpecifier const specifier = it->second;
+            result.predicate = [specifier](const CXCursor& cursor) {
+                return clang_getCXXAccessSpecifier(cursor) == specifier;
+            };
+        } else {
+            return fail();
+        }
+        return result;
+    }
+
+    auto const& flags = get_flags();
+    auto const it = flags.find(name);
+    if (it == flags.end())
+        return fail();
+
+    result.predicate = it->second;
+    result.required.insert(name);
+    result.flag = name;
+    return result;
+}
+
+bool query_parser::parse(term& result) {
+    result = parse_or();
+    skip_spaces();
+    return _valid && _pos == _text.size();
+}
+}
+
+libclang_vim::query_filter::query_filter() = default;
+
+bool libclang_vim::compile_query(const std::string& expression,
+                                 query_filter& filter) {
+    term result;
+    query_parser parser(expression);
+    if (!parser.parse(result))
+        return false;
+
+    auto const is_required = [&result](const char* flag) {
+        return result.required.count(flag) != 0;
+    };
+
+    filter.predicate = result.predicate;
+    if (is_required("in_main_file"))
+        filter.policy = extraction_policy::current_file;
+    else if (is_required("!in_system_header"))
+        filter.policy = extraction_policy::non_system_headers;
+
+    if (is_required("preprocessing") || is_required("translation_unit"))
+        filter.descend = never_descend;
+    else if (is_required("is_virtual") || is_required("is_pure_virtual") ||
+             is_required("is_static"))
+        filter.descend = may_contain_member_functions;
+    return true;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
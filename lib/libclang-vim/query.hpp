@@ -0,0 +1,33 @@
+#if !defined LIBCLANG_VIM_QUERY_HPP_INCLUDED
+#define LIBCLANG_VIM_QUERY_HPP_INCLUDED
+
+#include <functional>
+#include <string>
+
+#include <clang-c/Index.h>
+
+#include "AST_extracter.hpp"
+
+namespace libclang_vim {
+
+/// A filter expression of vim_clang_query() compiled into a predicate, e.g.
+/// "in_main_file && is_virtual && access=public && name=~'^on_'".
+class query_filter {
+  public:
+    std::function<bool(const CXCursor&)> predicate;
+    /// Chosen from the conditions which every match has to meet, so that
+    /// subtrees without matches are not visited at all.
+    extraction_policy policy = extraction_policy::all;
+    std::function<bool(const CXCursor&)> descend = always_descend;
+
+    query_filter();
+};
+
+/// Compiles expression into filter, returns false if it's invalid.
+bool compile_query(const std::string& expression, query_filter& filter);
+
+} // namespace libclang_vim
+
+#endif // LIBCLANG_VIM_QUERY_HPP_INCLUDED
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
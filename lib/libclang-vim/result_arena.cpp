@@ -0,0 +1,51 @@
+#include "result_arena.hpp"
+#include "vimson_writer.hpp"
+
+#include <utility>
+
+std::mutex libclang_vim::result_arena::_retained_mutex;
+
+std::unordered_map<const char*, std::unique_ptr<std::string>>
+    libclang_vim::result_arena::_retained;
+
+libclang_vim::result_arena::result_arena() = default;
+
+libclang_vim::result_arena& libclang_vim::result_arena::current() {
+    static thread_local result_arena arena;
+    return arena;
+}
+
+void libclang_vim::result_arena::set_retain(bool retain) { _retain = retain; }
+
+bool libclang_vim::result_arena::get_retain() const { return _retain; }
+
+const char* libclang_vim::result_arena::store(std::string result) {
+    if (!_retain) {
+        _last = std::move(result);
+        return _last.c_str();
+    }
+
+    std::unique_ptr<std::string> retained(new std::string(std::move(result)));
+    const char* c_str = retained->c_str();
+    std::lock_guard<std::mutex> lock(_retained_mutex);
+    _retained.emplace(c_str, std::move(retained));
+    return c_str;
+}
+
+bool libclang_vim::result_arena::free(const char* result) {
+    std::lock_guard<std::mutex> lock(_retained_mutex);
+    return _retained.erase(result) > 0;
+}
+
+const char* libclang_vim::store_result(std::string result) {
+    return result_arena::current().store(std::move(result));
+}
+
+const char* libclang_vim::store_result(std::string result,
+                                       const location_tuple& location_info) {
+    if (get_option(location_info, "format") == "json")
+        result = vimson_to_json(result);
+    return store_result(std::move(result));
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,63 @@
+#if !defined LIBCLANG_VIM_RESULT_ARENA_HPP_INCLUDED
+#define LIBCLANG_VIM_RESULT_ARENA_HPP_INCLUDED
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "helpers.hpp"
+
+namespace libclang_vim {
+
+/// Owns the strings returned by the exported functions. Each thread has its
+/// own arena, so calls from different threads don't overwrite each other's
+/// results.
+class result_arena {
+    /// The latest result, when results are not retained.
+    std::string _last;
+    bool _retain = false;
+
+    /// Retained results of all threads not freed yet, by their C string, so
+    /// that they can be freed from any thread.
+    static std::mutex _retained_mutex;
+    static std::unordered_map<const char*, std::unique_ptr<std::string>>
+        _retained;
+
+    result_arena();
+
+  public:
+    result_arena(const result_arena&) = delete;
+    result_arena& operator=(const result_arena&) = delete;
+
+    /// The arena of the calling thread.
+    static result_arena& current();
+
+    /// By default a result is valid till the next call from the same thread,
+    /// which is enough for libcall(). Retained results are valid till they
+    /// are freed.
+    void set_retain(bool retain);
+
+    bool get_retain() const;
+
+    /// Takes ownership of result and returns its C string.
+    const char* store(std::string result);
+
+    /// Frees a retained result of any thread, returns false if it's not
+    /// owned by an arena.
+    static bool free(const char* result);
+};
+
+/// Stores result in the arena of the calling thread.
+const char* store_result(std::string result);
+
+/// Same, but converts result to JSON first if location_info has
+/// --vim-clang-format=json.
+const char* store_result(std::string result,
+                         const location_tuple& location_info);
+
+} // namespace libclang_vim
+
+#endif // LIBCLANG_VIM_RESULT_ARENA_HPP_INCLUDED
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
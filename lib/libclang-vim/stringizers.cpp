@@ -1,33 +1,68 @@
 #include "stringizers.hpp"
 
-std::string libclang_vim::stringize_spell(CXCursor const& cursor) {
-    cxstring_ptr spell = clang_getCursorSpelling(cursor);
-    return stringize_key_value("spell", spell);
+#include <map>
+#include <sstream>
+
+unsigned libclang_vim::parse_cursor_fields(const std::string& names) {
+    static const std::map<std::string, unsigned> fields{
+        {"spell", cursor_field_spell},
+        {"type", cursor_field_type},
+        {"linkage", cursor_field_linkage},
+        {"parent", cursor_field_parent},
+        {"location", cursor_field_location},
+        {"kind", cursor_field_kind},
+        {"value", cursor_field_value},
+        {"extra", cursor_field_extra},
+        {"extent", cursor_field_extent},
+        {"included_file", cursor_field_included_file},
+    };
+
+    if (names.empty())
+        return all_cursor_fields;
+
+    unsigned result = 0;
+    std::stringstream stream(names);
+    std::string name;
+    while (std::getline(stream, name, ',')) {
+        auto const it = fields.find(name);
+        if (it != fields.end())
+            result |= it->second;
+    }
+    return result;
+}
+
+unsigned libclang_vim::get_cursor_fields(const location_tuple& location_info) {
+    return parse_cursor_fields(get_option(location_info, "fields"));
 }
 
-std::string libclang_vim::stringize_extra_type_info(CXType const& type) {
-    std::string result;
+void libclang_vim::stringize_spell(vimson_writer& writer,
+                                   CXCursor const& cursor) {
+    cxstring_ptr spell = clang_getCursorSpelling(cursor);
+    writer.append_key_value("spell", to_c_str(spell));
+}
 
+void libclang_vim::stringize_extra_type_info(vimson_writer& writer,
+                                             CXType const& type) {
     if (clang_isConstQualifiedType(type)) {
-        result += "'is_const_qualified':1,";
+        writer.append("'is_const_qualified':1,");
     }
     if (clang_isVolatileQualifiedType(type)) {
-        result += "'is_volatile_qualified':1,";
+        writer.append("'is_volatile_qualified':1,");
     }
     if (clang_isRestrictQualifiedType(type)) {
-        result += "'is_restrict_qualified':1,";
+        writer.append("'is_restrict_qualified':1,");
     }
     if (clang_isPODType(type)) {
-        result += "'is_POD_type':1,";
+        writer.append("'is_POD_type':1,");
     }
 
     auto const ref_qualified = clang_Type_getCXXRefQualifier(type);
     switch (ref_qualified) {
     case CXRefQualifier_LValue:
-        result += "'is_lvalue':1,";
+        writer.append("'is_lvalue':1,");
         break;
     case CXRefQualifier_RValue:
-        result += "'is_rvalue':1,";
+        writer.append("'is_rvalue':1,");
         break;
     case CXRefQualifier_None:
         break;
@@ -39,21 +74,25 @@ std::string libclang_vim::stringize_extra_type_info(CXType const& type) {
     // auto const calling_convention = clang_getFunctionTypeCallingConv(type);
     // switch (calling_convention) {
     // ...
-
-    return result;
 }
 
-std::string libclang_vim::stringize_type(CXType const& type) {
+void libclang_vim::stringize_type(vimson_writer& writer, CXType const& type) {
     CXTypeKind const type_kind = type.kind;
     cxstring_ptr type_name = clang_getTypeSpelling(type);
     cxstring_ptr type_kind_name = clang_getTypeKindSpelling(type_kind);
-    
-    return stringize_key_value("type", type_name) +
-           stringize_key_value("type_kind", type_kind_name) +
-           stringize_extra_type_info(type);
+
+    writer.append_key_value("type", to_c_str(type_name));
+    writer.append_kind("type_kind", to_c_str(type_kind_name));
+    stringize_extra_type_info(writer, type);
 }
 
-std::string libclang_vim::stringize_linkage_kind(CXLinkageKind const& linkage) {
+std::string libclang_vim::stringize_type(CXType const& type) {
+    vimson_writer writer;
+    stringize_type(writer, type);
+    return writer.release();
+}
+
+const char* libclang_vim::stringize_linkage_kind(CXLinkageKind const& linkage) {
     switch (linkage) {
     case CXLinkage_Invalid:
         return "";
@@ -66,16 +105,18 @@ std::string libclang_vim::stringize_linkage_kind(CXLinkageKind const& linkage) {
     case CXLinkage_External:
         return "External";
     }
+    return "";
 }
 
-std::string libclang_vim::stringize_linkage(CXCursor const& cursor) {
-    auto const linkage_kind_name =
-        stringize_linkage_kind(clang_getCursorLinkage(cursor));
-    return stringize_key_value("linkage", linkage_kind_name);
+void libclang_vim::stringize_linkage(vimson_writer& writer,
+                                     CXCursor const& cursor) {
+    writer.append_key_value(
+        "linkage", stringize_linkage_kind(clang_getCursorLinkage(cursor)));
 }
 
-std::string libclang_vim::stringize_parent(CXCursor const& cursor,
-                                           CXCursor const& parent) {
+void libclang_vim::stringize_parent(vimson_writer& writer,
+                                    CXCursor const& cursor,
+                                    CXCursor const& parent) {
     auto const semantic_parent = clang_getCursorSemanticParent(cursor);
     auto const lexical_parent = clang_getCursorLexicalParent(cursor);
     cxstring_ptr parent_name = clang_getCursorSpelling(parent);
@@ -83,28 +124,37 @@ std::string libclang_vim::stringize_parent(CXCursor const& cursor,
         clang_getCursorSpelling(semantic_parent);
     cxstring_ptr lexical_parent_name = clang_getCursorSpelling(lexical_parent);
 
-    return stringize_key_value("parent", parent_name) +
-           stringize_key_value("semantic_parent", semantic_parent_name) +
-           stringize_key_value("lexical_parent", lexical_parent_name);
+    writer.append_key_value("parent", to_c_str(parent_name));
+    writer.append_key_value("semantic_parent", to_c_str(semantic_parent_name));
+    writer.append_key_value("lexical_parent", to_c_str(lexical_parent_name));
 }
 
-std::string libclang_vim::stringize_location(CXSourceLocation const& location) {
+void libclang_vim::stringize_location(vimson_writer& writer,
+                                      CXSourceLocation const& location) {
     CXFile file;
     unsigned int line, column, offset;
     clang_getSpellingLocation(location, &file, &line, &column, &offset);
     cxstring_ptr file_name = clang_getFileName(file);
 
-    return "'line':" + std::to_string(line) + ",'column':" +
-           std::to_string(column) + ",'offset':" + std::to_string(offset) +
-           ',' + stringize_key_value("file", file_name);
+    writer.append("'line':").append_number(line);
+    writer.append(",'column':").append_number(column);
+    writer.append(",'offset':").append_number(offset).append(',');
+    writer.append_file("file", to_c_str(file_name));
 }
 
-std::string libclang_vim::stringize_cursor_location(CXCursor const& cursor) {
+std::string libclang_vim::stringize_location(CXSourceLocation const& location) {
+    vimson_writer writer;
+    stringize_location(writer, location);
+    return writer.release();
+}
+
+void libclang_vim::stringize_cursor_location(vimson_writer& writer,
+                                             CXCursor const& cursor) {
     CXSourceLocation const location = clang_getCursorLocation(cursor);
-    return stringize_location(location);
+    stringize_location(writer, location);
 }
 
-std::string libclang_vim::stringize_cursor_kind_type(CXCursorKind const& kind) {
+const char* libclang_vim::stringize_cursor_kind_type(CXCursorKind const& kind) {
     if (clang_isAttribute(kind))
         return "Attribute";
     if (clang_isDeclaration(kind))
@@ -126,132 +176,178 @@ std::string libclang_vim::stringize_cursor_kind_type(CXCursorKind const& kind) {
     return "Unknown";
 }
 
-std::string libclang_vim::stringize_cursor_extra_info(CXCursor const& cursor) {
-    std::string result;
-
+void libclang_vim::stringize_cursor_extra_info(vimson_writer& writer,
+                                               CXCursor const& cursor) {
     if (clang_isCursorDefinition(cursor)) {
-        result += "'is_definition':1,";
+        writer.append("'is_definition':1,");
     }
     if (clang_Cursor_isDynamicCall(cursor)) {
-        result += "'is_dynamic_call':1,";
+        writer.append("'is_dynamic_call':1,");
     }
     if (clang_Cursor_isVariadic(cursor)) {
-        result += "'is_variadic':1,";
+        writer.append("'is_variadic':1,");
     }
     if (clang_CXXMethod_isVirtual(cursor)) {
-        result += "'is_virtual_member_function':1,";
+        writer.append("'is_virtual_member_function':1,");
     }
     if (clang_CXXMethod_isPureVirtual(cursor)) {
-        result += "'is_pure_virtual_member_function':1,";
+        writer.append("'is_pure_virtual_member_function':1,");
     }
     if (clang_CXXMethod_isStatic(cursor)) {
-        result += "'is_static_member_function':1,";
+        writer.append("'is_static_member_function':1,");
     }
 
     auto const access_specifier = clang_getCXXAccessSpecifier(cursor);
     switch (access_specifier) {
     case CX_CXXPublic:
-        result += "'access_specifier':'public',";
+        writer.append("'access_specifier':'public',");
         break;
     case CX_CXXPrivate:
-        result += "'access_specifier':'private',";
+        writer.append("'access_specifier':'private',");
         break;
     case CX_CXXProtected:
-        result += "'access_specifier':'protected',";
+        writer.append("'access_specifier':'protected',");
         break;
     case CX_CXXInvalidAccessSpecifier:
         break;
     }
-
-    return result;
 }
 
-std::string libclang_vim::stringize_cursor_kind(CXCursor const& cursor) {
-    CXCursorKind const kind = clang_getCursorKind(cursor);
-    cxstring_ptr kind_name = clang_getCursorKindSpelling(kind);
-    auto const kind_type_name = stringize_cursor_kind_type(kind);
-
-    std::string res_str = "";
+namespace {
 
+/// Appends the spelling of the last token of a literal as its value.
+void stringize_literal_value(libclang_vim::vimson_writer& writer,
+                             CXCursor const& cursor,
+                             libclang_vim::token_index* index) {
     CXTranslationUnit tu = clang_Cursor_getTranslationUnit(cursor);
+    CXSourceRange range = clang_getCursorExtent(cursor);
 
-    const auto* kstring = clang_getCString(kind_name);
-    std::string kind_str = "";
-    if (kstring && std::strcmp(kstring, "") != 0) {
-        kind_str = std::string{kstring};
+    const char* value = nullptr;
+    if (index && index->find_last_spelling(tu, range, value)) {
+        if (value && *value)
+            writer.append("'value': '").append_escaped(value).append("',");
+        return;
     }
 
-    if (kind == CXCursor_IntegerLiteral || kind == CXCursor_FloatingLiteral
-        || kind == CXCursor_CharacterLiteral || kind == CXCursor_StringLiteral
-        || kind == CXCursor_FixedPointLiteral || kind == CXCursor_ImaginaryLiteral)
-    {
-        CXSourceRange range = clang_getCursorExtent(cursor);
-        CXToken *tokens = 0;
-        unsigned int nTokens = 0;
-        clang_tokenize(tu, range, &tokens, &nTokens);
-        for (unsigned int i = 0; i < nTokens; i++)
-        {
-            cxstring_ptr spelling = clang_getTokenSpelling(tu, tokens[i]);
-            const auto*  s = clang_getCString(spelling);
-            if (s && std::strcmp(s, "") != 0) {
-                res_str = "'value': '" + std::string{s} + "',";
-            }
-            //clang_disposeString(spelling);
+    CXToken* tokens = nullptr;
+    unsigned int nTokens = 0;
+    clang_tokenize(tu, range, &tokens, &nTokens);
+    // The spelling of the last non-empty token is the value.
+    for (unsigned int i = nTokens; i > 0; --i) {
+        libclang_vim::cxstring_ptr spelling =
+            clang_getTokenSpelling(tu, tokens[i - 1]);
+        const auto* s = clang_getCString(spelling);
+        if (s && std::strcmp(s, "") != 0) {
+            writer.append("'value': '").append_escaped(s).append("',");
+            break;
         }
-        clang_disposeTokens(tu, tokens, nTokens);
+    }
+    clang_disposeTokens(tu, tokens, nTokens);
+}
+}
+
+void libclang_vim::stringize_cursor_kind(vimson_writer& writer,
+                                         CXCursor const& cursor,
+                                         unsigned fields,
+                                         token_index* index) {
+    CXCursorKind const kind = clang_getCursorKind(cursor);
+
+    if (fields & cursor_field_kind) {
+        cxstring_ptr kind_name = clang_getCursorKindSpelling(kind);
+        writer.append_kind("kind", to_c_str(kind_name));
     }
 
-    return stringize_key_value("kind", kind_name) +
-        res_str + 
-        (kind_type_name.empty() ? std::string{} : ("'kind_type':'" +
-                                                      kind_type_name + "',")) +
-           stringize_cursor_extra_info(cursor);
+    bool const is_literal =
+        kind == CXCursor_IntegerLiteral || kind == CXCursor_FloatingLiteral ||
+        kind == CXCursor_CharacterLiteral || kind == CXCursor_StringLiteral ||
+        kind == CXCursor_FixedPointLiteral || kind == CXCursor_ImaginaryLiteral;
+    if (is_literal && (fields & cursor_field_value))
+        stringize_literal_value(writer, cursor, index);
+
+    if (fields & cursor_field_kind)
+        writer.append_kind("kind_type", stringize_cursor_kind_type(kind));
+    if (fields & cursor_field_extra)
+        stringize_cursor_extra_info(writer, cursor);
 }
 
-std::string libclang_vim::stringize_included_file(CXCursor const& cursor) {
+void libclang_vim::stringize_included_file(vimson_writer& writer,
+                                           CXCursor const& cursor) {
     CXFile included_file = clang_getIncludedFile(cursor);
     if (included_file == nullptr) {
-        return "";
+        return;
     }
 
     cxstring_ptr included_file_name = clang_getFileName(included_file);
-    return std::string("'included_file':'") + to_c_str(included_file_name) +
-           "',";
+    writer.append_file("included_file", to_c_str(included_file_name));
+}
+
+void libclang_vim::stringize_cursor(vimson_writer& writer,
+                                    CXCursor const& cursor,
+                                    CXCursor const& parent, unsigned fields,
+                                    token_index* index) {
+    if (fields & cursor_field_spell)
+        stringize_spell(writer, cursor);
+    if (fields & cursor_field_type)
+        stringize_type(writer, clang_getCursorType(cursor));
+    if (fields & cursor_field_linkage)
+        stringize_linkage(writer, cursor);
+    if (fields & cursor_field_parent)
+        stringize_parent(writer, cursor, parent);
+    if (fields & cursor_field_location)
+        stringize_cursor_location(writer, cursor);
+    if (fields & (cursor_field_kind | cursor_field_value | cursor_field_extra))
+        stringize_cursor_kind(writer, cursor, fields, index);
+    if (fields & cursor_field_extent)
+        stringize_end(writer, cursor);
+    if (fields & cursor_field_included_file)
+        stringize_included_file(writer, cursor);
 }
 
 std::string libclang_vim::stringize_cursor(CXCursor const& cursor,
-                                           CXCursor const& parent) {
-    return stringize_spell(cursor) +
-           stringize_type(clang_getCursorType(cursor)) +
-           stringize_linkage(cursor) + stringize_parent(cursor, parent) +
-           stringize_cursor_location(cursor) + stringize_cursor_kind(cursor) +
-           stringize_end(cursor) +   
-           stringize_included_file(cursor);
+                                           CXCursor const& parent,
+                                           unsigned fields) {
+    vimson_writer writer;
+    stringize_cursor(writer, cursor, parent, fields);
+    return writer.release();
 }
 
-std::string libclang_vim::stringize_range(CXSourceRange const& range) {
+void libclang_vim::stringize_range(vimson_writer& writer,
+                                   CXSourceRange const& range) {
     if (clang_Range_isNull(range)) {
-        return "";
+        return;
     }
-    return "'range':{'start':{" +
-           stringize_location(clang_getRangeStart(range)) + "},'end':{" +
-           stringize_location(clang_getRangeEnd(range)) + "}},";
+    writer.append("'range':{'start':{");
+    stringize_location(writer, clang_getRangeStart(range));
+    writer.append("},'end':{");
+    stringize_location(writer, clang_getRangeEnd(range));
+    writer.append("}},");
 }
 
-std::string libclang_vim::stringize_end(CXCursor const& cursor) {
+void libclang_vim::stringize_end(vimson_writer& writer,
+                                 CXCursor const& cursor) {
     auto const r = clang_getCursorExtent(cursor);
     if (clang_Range_isNull(r))
-        return "";
-    return "'start':{" + stringize_location(clang_getRangeStart(r)) +
-           "},'end':{" + stringize_location(clang_getRangeEnd(r)) + "},";
+        return;
+    stringize_extent(writer, cursor);
+    writer.append(',');
 }
 
-std::string libclang_vim::stringize_extent(CXCursor const& cursor) {
+void libclang_vim::stringize_extent(vimson_writer& writer,
+                                    CXCursor const& cursor) {
     auto const r = clang_getCursorExtent(cursor);
     if (clang_Range_isNull(r))
-        return "";
-    return "'start':{" + stringize_location(clang_getRangeStart(r)) +
-           "},'end':{" + stringize_location(clang_getRangeEnd(r)) + "}";
+        return;
+    writer.append("'start':{");
+    stringize_location(writer, clang_getRangeStart(r));
+    writer.append("},'end':{");
+    stringize_location(writer, clang_getRangeEnd(r));
+    writer.append('}');
+}
+
+std::string libclang_vim::stringize_extent(CXCursor const& cursor) {
+    vimson_writer writer;
+    stringize_extent(writer, cursor);
+    return writer.release();
 }
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
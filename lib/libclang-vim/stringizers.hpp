@@ -6,38 +6,92 @@
 #include <clang-c/Index.h>
 
 #include "helpers.hpp"
+#include "token_index.hpp"
+#include "vimson_writer.hpp"
 
 namespace libclang_vim {
 
-std::string stringize_spell(CXCursor const& cursor);
-
-std::string stringize_extra_type_info(CXType const& type);
+/// Groups of fields of a node, which can be selected with the
+/// --vim-clang-fields option to skip the libclang calls of the others.
+enum cursor_field : unsigned {
+    /// spell
+    cursor_field_spell = 1u << 0,
+    /// type, type_kind and the is_*_qualified etc. flags of the type
+    cursor_field_type = 1u << 1,
+    /// linkage
+    cursor_field_linkage = 1u << 2,
+    /// parent, semantic_parent and lexical_parent
+    cursor_field_parent = 1u << 3,
+    /// line, column, offset and file
+    cursor_field_location = 1u << 4,
+    /// kind and kind_type
+    cursor_field_kind = 1u << 5,
+    /// value of literals
+    cursor_field_value = 1u << 6,
+    /// is_definition, is_virtual_member_function, access_specifier etc.
+    cursor_field_extra = 1u << 7,
+    /// start and end
+    cursor_field_extent = 1u << 8,
+    /// included_file
+    cursor_field_included_file = 1u << 9,
+    all_cursor_fields = (1u << 10) - 1,
+};
+
+/// Parses a comma separated list of field groups, like "spell,location,kind".
+/// Returns all_cursor_fields for an empty list, ignores unknown names.
+unsigned parse_cursor_fields(const std::string& names);
+
+/// The fields selected by the --vim-clang-fields option of location_info.
+unsigned get_cursor_fields(const location_tuple& location_info);
+
+void stringize_spell(vimson_writer& writer, CXCursor const& cursor);
+
+void stringize_extra_type_info(vimson_writer& writer, CXType const& type);
+
+void stringize_type(vimson_writer& writer, CXType const& type);
 
 std::string stringize_type(CXType const& type);
 
-std::string stringize_linkage_kind(CXLinkageKind const& linkage);
+const char* stringize_linkage_kind(CXLinkageKind const& linkage);
+
+void stringize_linkage(vimson_writer& writer, CXCursor const& cursor);
 
-std::string stringize_linkage(CXCursor const& cursor);
+void stringize_parent(vimson_writer& writer, CXCursor const& cursor,
+                      CXCursor const& parent);
 
-std::string stringize_parent(CXCursor const& cursor, CXCursor const& parent);
+void stringize_location(vimson_writer& writer,
+                        CXSourceLocation const& location);
 
 std::string stringize_location(CXSourceLocation const& location);
 
-std::string stringize_cursor_location(CXCursor const& cursor);
+void stringize_cursor_location(vimson_writer& writer, CXCursor const& cursor);
+
+const char* stringize_cursor_kind_type(CXCursorKind const& kind);
+
+void stringize_cursor_extra_info(vimson_writer& writer,
+                                 CXCursor const& cursor);
 
-std::string stringize_cursor_kind_type(CXCursorKind const& kind);
+/// The value of literals is looked up in index if given, otherwise the
+/// literal is tokenized.
+void stringize_cursor_kind(vimson_writer& writer, CXCursor const& cursor,
+                           unsigned fields = all_cursor_fields,
+                           token_index* index = nullptr);
 
-std::string stringize_cursor_extra_info(CXCursor const& cursor);
+void stringize_included_file(vimson_writer& writer, CXCursor const& cursor);
 
-std::string stringize_cursor_kind(CXCursor const& cursor);
+void stringize_cursor(vimson_writer& writer, CXCursor const& cursor,
+                      CXCursor const& parent,
+                      unsigned fields = all_cursor_fields,
+                      token_index* index = nullptr);
 
-std::string stringize_included_file(CXCursor const& cursor);
+std::string stringize_cursor(CXCursor const& cursor, CXCursor const& parent,
+                             unsigned fields = all_cursor_fields);
 
-std::string stringize_cursor(CXCursor const& cursor, CXCursor const& parent);
+void stringize_range(vimson_writer& writer, CXSourceRange const& range);
 
-std::string stringize_range(CXSourceRange const& range);
+void stringize_end(vimson_writer& writer, CXCursor const& currsor);
 
-std::string stringize_end(CXCursor const& currsor);
+void stringize_extent(vimson_writer& writer, CXCursor const& cursor);
 
 std::string stringize_extent(CXCursor const& cursor);
 
@@ -0,0 +1,86 @@
+#include "token_index.hpp"
+#include "helpers.hpp"
+
+#include <algorithm>
+
+libclang_vim::token_index::file_tokens::file_tokens() = default;
+
+libclang_vim::token_index::token_index() = default;
+
+const libclang_vim::token_index::file_tokens&
+libclang_vim::token_index::get_file_tokens(CXTranslationUnit translation_unit,
+                                           CXFile file) {
+    auto const inserted = _files.emplace(file, file_tokens());
+    file_tokens& result = inserted.first->second;
+    if (!inserted.second)
+        return result;
+
+#if CINDEX_VERSION_MINOR >= 47
+    // Also knows the size of unsaved buffers.
+    size_t size = 0;
+    if (!clang_getFileContents(translation_unit, file, &size))
+        return result;
+#else
+    cxstring_ptr file_name = clang_getFileName(file);
+    size_t const size = get_file_size(to_c_str(file_name));
+#endif
+    auto const begin = clang_getLocationForOffset(translation_unit, file, 0);
+    auto const end = clang_getLocationForOffset(translation_unit, file, size);
+    if (is_null_location(begin) || is_null_location(end))
+        return result;
+
+    CXToken* tokens = nullptr;
+    unsigned token_count = 0;
+    clang_tokenize(translation_unit, clang_getRange(begin, end), &tokens,
+                   &token_count);
+    for (unsigned i = 0; i < token_count; ++i) {
+        CXTokenKind const kind = clang_getTokenKind(tokens[i]);
+        if (kind != CXToken_Literal && kind != CXToken_Identifier)
+            continue;
+
+        unsigned offset = 0;
+        clang_getExpansionLocation(
+            clang_getTokenLocation(translation_unit, tokens[i]), nullptr,
+            nullptr, nullptr, &offset);
+        cxstring_ptr spelling =
+            clang_getTokenSpelling(translation_unit, tokens[i]);
+        result.offsets.push_back(offset);
+        result.spellings.emplace_back(to_c_str(spelling));
+    }
+    clang_disposeTokens(translation_unit, tokens, token_count);
+    result.valid = true;
+    return result;
+}
+
+bool libclang_vim::token_index::find_last_spelling(
+    CXTranslationUnit translation_unit, CXSourceRange range,
+    const char*& spelling) {
+    CXFile file = nullptr;
+    CXFile end_file = nullptr;
+    unsigned begin_offset = 0;
+    unsigned end_offset = 0;
+    clang_getExpansionLocation(clang_getRangeStart(range), &file, nullptr,
+                               nullptr, &begin_offset);
+    clang_getExpansionLocation(clang_getRangeEnd(range), &end_file, nullptr,
+                               nullptr, &end_offset);
+    if (!file || file != end_file)
+        return false;
+
+    const file_tokens& tokens = get_file_tokens(translation_unit, file);
+    if (!tokens.valid)
+        return false;
+
+    // The last token which starts before the end of range.
+    auto const it = std::lower_bound(tokens.offsets.begin(),
+                                     tokens.offsets.end(), end_offset);
+    spelling = nullptr;
+    if (it != tokens.offsets.begin() && *(it - 1) >= begin_offset) {
+        auto const index = it - 1 - tokens.offsets.begin();
+        spelling = tokens.spellings[index].c_str();
+    }
+    return true;
+}
+
+void libclang_vim::token_index::clear() { _files.clear(); }
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
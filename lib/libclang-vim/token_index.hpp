@@ -0,0 +1,49 @@
+#if !defined LIBCLANG_VIM_TOKEN_INDEX_HPP_INCLUDED
+#define LIBCLANG_VIM_TOKEN_INDEX_HPP_INCLUDED
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <clang-c/Index.h>
+
+namespace libclang_vim {
+
+/// Spellings of the literal and identifier tokens of the files of a
+/// translation unit, sorted by offset. Each file is tokenized once, on the
+/// first lookup in it, so that the value of a literal costs a binary search
+/// instead of a clang_tokenize() call.
+class token_index {
+    class file_tokens {
+      public:
+        std::vector<unsigned> offsets;
+        std::vector<std::string> spellings;
+        /// False if the file could not be tokenized.
+        bool valid = false;
+
+        file_tokens();
+    };
+
+    std::map<CXFile, file_tokens> _files;
+
+    const file_tokens& get_file_tokens(CXTranslationUnit translation_unit,
+                                       CXFile file);
+
+  public:
+    token_index();
+
+    /// Sets spelling to the last literal or identifier token in range, or to
+    /// nullptr if there is none. Returns false if the file of range can't be
+    /// indexed, then the caller has to tokenize range itself.
+    bool find_last_spelling(CXTranslationUnit translation_unit,
+                            CXSourceRange range, const char*& spelling);
+
+    /// Forgets all files, needed when the unit is reparsed.
+    void clear();
+};
+
+} // namespace libclang_vim
+
+#endif // LIBCLANG_VIM_TOKEN_INDEX_HPP_INCLUDED
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
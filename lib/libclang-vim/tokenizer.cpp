@@ -1,12 +1,188 @@
 #include "tokenizer.hpp"
-#include <numeric>
+#include "translation_unit_cache.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <tuple>
+
+namespace {
+
+/// The token list which tokenize_changes_as_vimson() described last time.
+class token_snapshot {
+  public:
+    std::vector<char> contents;
+    std::string file_name;
+    std::vector<libclang_vim::token_info> tokens;
+    unsigned long last_use = 0;
+};
+
+/// Absolute file name, compiler arguments and annotated mode.
+using snapshot_key = std::tuple<std::string, libclang_vim::args_type, bool>;
+
+std::mutex snapshots_mutex;
+std::map<snapshot_key, token_snapshot> snapshots;
+unsigned long snapshot_use_counter = 0;
+
+void evict_least_recently_used_snapshot() {
+    auto oldest = snapshots.begin();
+    for (auto it = snapshots.begin(); it != snapshots.end(); ++it) {
+        if (it->second.last_use < oldest->second.last_use)
+            oldest = it;
+    }
+    if (oldest != snapshots.end())
+        snapshots.erase(oldest);
+}
+
+/// Byte range of a file to tokenize again after an edit, extended to whole
+/// lines and whole tokens. Starts at the same offset in both versions.
+class changed_region {
+  public:
+    unsigned start = 0;
+    unsigned old_end = 0;
+    unsigned new_end = 0;
+};
+
+changed_region
+get_changed_region(const std::vector<char>& old_contents,
+                   const std::vector<char>& new_contents,
+                   const std::vector<libclang_vim::token_info>& old_tokens) {
+    std::size_t const common =
+        std::min(old_contents.size(), new_contents.size());
+    std::size_t prefix = 0;
+    while (prefix < common && old_contents[prefix] == new_contents[prefix])
+        ++prefix;
+    std::size_t suffix = 0;
+    while (suffix < common - prefix &&
+           old_contents[old_contents.size() - suffix - 1] ==
+               new_contents[new_contents.size() - suffix - 1])
+        ++suffix;
+
+    changed_region region;
+    std::size_t start = prefix;
+    while (start > 0 && old_contents[start - 1] != '\n')
+        --start;
+    std::size_t old_end = old_contents.size() - suffix;
+    while (old_end < old_contents.size() && old_contents[old_end] != '\n')
+        ++old_end;
+    region.start = start;
+    region.old_end = old_end;
+
+    // Tokens like block comments may span several lines.
+    auto const first = std::find_if(
+        old_tokens.begin(), old_tokens.end(),
+        [&region](const libclang_vim::token_info& token) {
+            return token.end_offset > region.start;
+        });
+    if (first != old_tokens.end() && first->offset < region.start)
+        region.start = first->offset;
+    for (auto it = first; it != old_tokens.end() && it->offset < region.old_end;
+         ++it) {
+        region.old_end = std::max(region.old_end, it->end_offset);
+    }
+
+    region.new_end =
+        new_contents.size() - (old_contents.size() - region.old_end);
+    return region;
+}
+
+std::size_t count_lines(const std::vector<char>& contents, std::size_t begin,
+                        std::size_t end) {
+    return std::count(contents.begin() + begin, contents.begin() + end, '\n');
+}
+
+void append_signed_number(libclang_vim::vimson_writer& writer, long number) {
+    if (number < 0)
+        writer.append('-').append_number(-number);
+    else
+        writer.append_number(number);
+}
+
+/// How far find_enclosing_token() looks back, so that tokenizing a few lines
+/// costs the same in small and huge files.
+const std::size_t max_lookbehind = 64 * 1024;
+
+bool is_identifier_char(char c) {
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+/// Returns the start of the block comment or raw string literal which offset
+/// is inside of, or offset if there is none. Only the max_lookbehind bytes
+/// before offset are scanned: from the start of a line there, skipping the
+/// comments and literals which end before offset.
+std::size_t find_enclosing_token(const char* contents, std::size_t offset) {
+    std::size_t i = offset > max_lookbehind ? offset - max_lookbehind : 0;
+    while (i > 0 && contents[i - 1] != '\n')
+        ++i;
+
+    // Returns the offset after needle, or npos if it doesn't end before
+    // offset.
+    auto const find_end = [contents, offset](std::size_t from,
+                                             const std::string& needle) {
+        const char* const found =
+            std::search(contents + from, contents + offset, needle.begin(),
+                        needle.end());
+        if (found == contents + offset)
+            return std::string::npos;
+        return static_cast<std::size_t>(found - contents) + needle.size();
+    };
+
+    while (i < offset) {
+        char const c = contents[i];
+        char const next = i + 1 < offset ? contents[i + 1] : '\0';
+        if (c == '/' && next == '/') {
+            // Ends at the end of the line, so before offset.
+            i = std::find(contents + i, contents + offset, '\n') - contents;
+        } else if (c == '/' && next == '*') {
+            std::size_t const end = find_end(i + 2, "*/");
+            if (end == std::string::npos)
+                return i;
+            i = end;
+        } else if (c == 'R' && next == '"' &&
+                   (i == 0 || !is_identifier_char(contents[i - 1]) ||
+                    std::strchr("LuU8", contents[i - 1]))) {
+            // R"delimiter( ... )delimiter"
+            std::size_t const open = std::find(contents + i + 2,
+                                               contents + offset, '(') -
+                                     contents;
+            std::string const delimiter(contents + i + 2, contents + open);
+            if (open == offset || delimiter.size() > 16 ||
+                delimiter.find_first_of(" \\)\t\n") != std::string::npos) {
+                ++i;
+                continue;
+            }
+            std::size_t const end = find_end(open + 1, ")" + delimiter + "\"");
+            if (end == std::string::npos)
+                return i;
+            i = end;
+        } else if (c == '"' ||
+                   (c == '\'' && (i == 0 || !is_identifier_char(
+                                                contents[i - 1])))) {
+            // Ordinary literals end on their line. A quote after a digit is a
+            // digit separator.
+            for (++i; i < offset && contents[i] != c && contents[i] != '\n';
+                 ++i) {
+                if (contents[i] == '\\')
+                    ++i;
+            }
+            ++i;
+        } else {
+            ++i;
+        }
+    }
+    return offset;
+}
+}
+
+libclang_vim::token_info::token_info() = default;
 
 CXSourceRange libclang_vim::tokenizer::get_range_whole_file(
-    const location_tuple& tuple,
-    const libclang_vim::cxtranslation_unit_ptr& translation_unit) const {
-    size_t const file_size = tuple.unsaved_file.empty()
-                                 ? get_file_size(tuple.file.c_str())
-                                 : tuple.unsaved_file.size();
+    const location_tuple& tuple, CXTranslationUnit translation_unit) const {
+    size_t const file_size = tuple.unsaved_file
+                                 ? tuple.unsaved_file->size()
+                                 : get_file_size(tuple.file.c_str());
     CXFile file = clang_getFile(translation_unit, tuple.file.c_str());
 
     auto const file_begin =
@@ -40,47 +216,104 @@ libclang_vim::tokenizer::get_kind_spelling(const CXTokenKind kind) const {
     case CXToken_Comment:
         return "comment";
     }
+    return "";
+}
+
+std::vector<libclang_vim::token_info>
+libclang_vim::tokenizer::get_tokens(CXTranslationUnit translation_unit,
+                                    CXSourceRange range, std::string& file_name,
+                                    bool annotate) const {
+    CXToken* tokens;
+    unsigned int num_tokens;
+    clang_tokenize(translation_unit, range, &tokens, &num_tokens);
+
+    std::vector<CXCursor> cursors;
+    if (annotate) {
+        // One pass over the AST for all tokens.
+        cursors.resize(num_tokens);
+        clang_annotateTokens(translation_unit, tokens, num_tokens,
+                             cursors.data());
+    }
+
+    std::vector<token_info> result(num_tokens);
+    for (unsigned int i = 0; i < num_tokens; ++i) {
+        token_info& info = result[i];
+        info.kind = clang_getTokenKind(tokens[i]);
+        cxstring_ptr spell =
+            clang_getTokenSpelling(translation_unit, tokens[i]);
+        info.spell = to_c_str(spell);
+
+        CXFile file;
+        auto const location =
+            clang_getTokenLocation(translation_unit, tokens[i]);
+        clang_getFileLocation(location, &file, &info.line, &info.column,
+                              &info.offset);
+        auto const end = clang_getRangeEnd(
+            clang_getTokenExtent(translation_unit, tokens[i]));
+        clang_getFileLocation(end, nullptr, nullptr, nullptr, &info.end_offset);
+
+        if (i == 0) {
+            cxstring_ptr source_name = clang_getFileName(file);
+            file_name = to_c_str(source_name);
+        }
+
+        if (annotate) {
+            const CXCursor& cursor = cursors[i];
+            info.cursor_kind = clang_getCursorKind(cursor);
+            info.referenced_kind =
+                clang_getCursorKind(clang_getCursorReferenced(cursor));
+            info.type_kind = clang_getCursorType(cursor).kind;
+        }
+    }
+
+    clang_disposeTokens(translation_unit, tokens, num_tokens);
+    return result;
 }
 
-std::string libclang_vim::tokenizer::make_vimson_from_tokens(
-    const libclang_vim::cxtranslation_unit_ptr& translation_unit,
-    std::vector<CXToken> tokens) const {
-    return "[" + std::accumulate(
-                     std::begin(tokens), std::end(tokens), std::string{},
-                     [&](std::string const& acc, CXToken const& token) {
-                         auto const kind = clang_getTokenKind(token);
-                         cxstring_ptr spell =
-                             clang_getTokenSpelling(translation_unit, token);
-                         auto const location =
-                             clang_getTokenLocation(translation_unit, token);
-
-                         CXFile file;
-                         unsigned int line, column, offset;
-                         clang_getFileLocation(location, &file, &line, &column,
-                                               &offset);
-                         cxstring_ptr source_name = clang_getFileName(file);
-
-                         return acc + "{'spell':'" + to_c_str(spell) +
-                                "','kind':'" + get_kind_spelling(kind) +
-                                "','file':'" + clang_getCString(source_name) +
-                                "','line':" + std::to_string(line) +
-                                ",'column':" + std::to_string(column) +
-                                ",'offset':" + std::to_string(offset) + "},";
-                     }) +
-           "]";
+void libclang_vim::tokenizer::make_vimson_from_tokens(
+    vimson_writer& writer, const std::string& file_name,
+    std::vector<token_info>::const_iterator begin,
+    std::vector<token_info>::const_iterator end, bool annotate) const {
+    // A token is about a hundred bytes of vimson, mostly the file name.
+    writer.reserve(writer.size() + (end - begin) * (64 + file_name.size()));
+    writer.append('[');
+    for (auto it = begin; it != end; ++it) {
+        writer.append("{'spell':'").append_escaped(it->spell.c_str());
+        writer.append("','kind':'").append(get_kind_spelling(it->kind));
+        writer.append("','file':'").append_escaped(file_name.c_str());
+        writer.append("','line':").append_number(it->line);
+        writer.append(",'column':").append_number(it->column);
+        writer.append(",'offset':").append_number(it->offset);
+        if (annotate) {
+            if (!clang_isInvalid(it->cursor_kind)) {
+                cxstring_ptr kind =
+                    clang_getCursorKindSpelling(it->cursor_kind);
+                writer.append(",'cursor_kind':'")
+                    .append(to_c_str(kind))
+                    .append('\'');
+            }
+            if (!clang_isInvalid(it->referenced_kind)) {
+                cxstring_ptr kind =
+                    clang_getCursorKindSpelling(it->referenced_kind);
+                writer.append(",'referenced_kind':'")
+                    .append(to_c_str(kind))
+                    .append('\'');
+            }
+            if (it->type_kind != CXType_Invalid) {
+                cxstring_ptr kind = clang_getTypeKindSpelling(it->type_kind);
+                writer.append(",'type_kind':'")
+                    .append(to_c_str(kind))
+                    .append('\'');
+            }
+        }
+        writer.append("},");
+    }
+    writer.append(']');
 }
 
 std::string
 libclang_vim::tokenizer::tokenize_as_vimson(const location_tuple& tuple) {
-    cxindex_ptr index =
-        clang_createIndex(/*excludeDeclsFromPCH*/ 1, /*displayDiagnostics*/ 0);
-
-    std::vector<const char*> args_ptrs = get_args_ptrs(tuple.args);
-    std::vector<CXUnsavedFile> unsaved_files = create_unsaved_files(tuple);
-    unsigned options = CXTranslationUnit_Incomplete;
-    cxtranslation_unit_ptr translation_unit = clang_parseTranslationUnit(
-        index, tuple.file.c_str(), args_ptrs.data(), args_ptrs.size(),
-        unsaved_files.data(), unsaved_files.size(), options);
+    locked_translation_unit translation_unit = parse_translation_unit(tuple);
     if (!translation_unit)
         return "{}";
 
@@ -88,16 +321,169 @@ libclang_vim::tokenizer::tokenize_as_vimson(const location_tuple& tuple) {
     if (clang_Range_isNull(file_range))
         return "{}";
 
-    CXToken* tokens_;
-    unsigned int num_tokens;
-    clang_tokenize(translation_unit, file_range, &tokens_, &num_tokens);
-    std::vector<CXToken> tokens(tokens_, tokens_ + num_tokens);
+    bool const annotate = get_option(tuple, "annotate") == "1";
+    std::string file_name;
+    auto const tokens =
+        get_tokens(translation_unit, file_range, file_name, annotate);
 
-    auto result = make_vimson_from_tokens(translation_unit, tokens);
+    vimson_writer writer;
+    make_vimson_from_tokens(writer, file_name, tokens.begin(), tokens.end(),
+                            annotate);
+    return writer.release();
+}
 
-    clang_disposeTokens(translation_unit, tokens_, num_tokens);
+std::string libclang_vim::tokenizer::tokenize_lines_as_vimson(
+    const location_tuple& tuple, unsigned first_line, unsigned last_line) {
+    locked_translation_unit translation_unit = parse_translation_unit(tuple);
+    if (!translation_unit)
+        return "{}";
 
-    return result;
+    CXFile file = clang_getFile(translation_unit, tuple.file.c_str());
+    if (!file)
+        return "{}";
+
+    first_line = std::max(first_line, 1u);
+    last_line = std::max(last_line, first_line);
+    // Columns past the end of a line are clamped to its end, lines past the
+    // end of the file to the end of the file.
+    auto begin = clang_getLocation(translation_unit, file, first_line, 1);
+    auto const end = clang_getLocation(translation_unit, file, last_line,
+                                       std::numeric_limits<unsigned>::max());
+    if (is_null_location(begin) || is_null_location(end))
+        return "{}";
+
+    // Lexing starts at begin, which may be inside a block comment or a raw
+    // string: start at that token instead.
+#if CINDEX_VERSION_MINOR >= 47
+    size_t size = 0;
+    const char* contents = clang_getFileContents(translation_unit, file, &size);
+#else
+    std::vector<char> const file_contents = get_file_contents(tuple);
+    const char* contents = file_contents.data();
+    size_t const size = file_contents.size();
+#endif
+    unsigned begin_offset = 0;
+    clang_getFileLocation(begin, nullptr, nullptr, nullptr, &begin_offset);
+    if (contents && begin_offset <= size) {
+        std::size_t const token_offset =
+            find_enclosing_token(contents, begin_offset);
+        if (token_offset != begin_offset)
+            begin = clang_getLocationForOffset(translation_unit, file,
+                                               token_offset);
+    }
+
+    bool const annotate = get_option(tuple, "annotate") == "1";
+    std::string file_name;
+    auto const tokens = get_tokens(translation_unit, clang_getRange(begin, end),
+                                   file_name, annotate);
+
+    vimson_writer writer;
+    make_vimson_from_tokens(writer, file_name, tokens.begin(), tokens.end(),
+                            annotate);
+    return writer.release();
+}
+
+std::string libclang_vim::tokenizer::tokenize_changes_as_vimson(
+    const location_tuple& tuple) {
+    locked_translation_unit translation_unit = parse_translation_unit(tuple);
+    if (!translation_unit)
+        return "{}";
+
+    std::vector<char> contents = get_file_contents(tuple);
+    CXFile file = clang_getFile(translation_unit, tuple.file.c_str());
+
+    std::lock_guard<std::mutex> lock(snapshots_mutex);
+    bool const annotate = get_option(tuple, "annotate") == "1";
+    snapshot_key key{get_absolute_path(tuple.file), tuple.args, annotate};
+    auto it = snapshots.find(key);
+    bool const known = it != snapshots.end();
+    if (!known) {
+        if (snapshots.size() >= translation_unit_cache::max_entries)
+            evict_least_recently_used_snapshot();
+        it = snapshots.emplace(key, token_snapshot()).first;
+    }
+    token_snapshot& snapshot = it->second;
+    snapshot.last_use = ++snapshot_use_counter;
+
+    vimson_writer writer;
+    if (known) {
+        changed_region const region =
+            get_changed_region(snapshot.contents, contents, snapshot.tokens);
+        CXSourceRange const range = clang_getRange(
+            clang_getLocationForOffset(translation_unit, file, region.start),
+            clang_getLocationForOffset(translation_unit, file,
+                                       region.new_end));
+        std::string file_name = snapshot.file_name;
+        std::vector<token_info> tokens =
+            get_tokens(translation_unit, range, file_name, annotate);
+
+        // An edit like an unterminated block comment changes the following
+        // lines as well, then only a full update helps.
+        if (tokens.empty() || tokens.back().end_offset <= region.new_end) {
+            auto const first = std::lower_bound(
+                snapshot.tokens.begin(), snapshot.tokens.end(), region.start,
+                [](const token_info& token, unsigned offset) {
+                    return token.offset < offset;
+                });
+            auto const last = std::lower_bound(
+                first, snapshot.tokens.end(), region.old_end,
+                [](const token_info& token, unsigned offset) {
+                    return token.offset < offset;
+                });
+            long const offset_delta =
+                static_cast<long>(contents.size()) -
+                static_cast<long>(snapshot.contents.size());
+            long const line_delta =
+                static_cast<long>(
+                    count_lines(contents, region.start, region.new_end)) -
+                static_cast<long>(count_lines(snapshot.contents, region.start,
+                                              region.old_end));
+
+            writer.append("{'full':0,'first':")
+                .append_number(first - snapshot.tokens.begin());
+            writer.append(",'removed':").append_number(last - first);
+            writer.append(",'line_delta':");
+            append_signed_number(writer, line_delta);
+            writer.append(",'offset_delta':");
+            append_signed_number(writer, offset_delta);
+            writer.append(",'tokens':");
+            make_vimson_from_tokens(writer, file_name, tokens.begin(),
+                                    tokens.end(), annotate);
+            writer.append('}');
+
+            for (auto shifted = last; shifted != snapshot.tokens.end();
+                 ++shifted) {
+                shifted->line += line_delta;
+                shifted->offset += offset_delta;
+                shifted->end_offset += offset_delta;
+            }
+            auto const position = snapshot.tokens.erase(first, last);
+            snapshot.tokens.insert(position, tokens.begin(), tokens.end());
+            snapshot.contents = std::move(contents);
+            snapshot.file_name = file_name;
+            return writer.release();
+        }
+    }
+
+    auto file_range = get_range_whole_file(tuple, translation_unit);
+    if (clang_Range_isNull(file_range)) {
+        snapshots.erase(it);
+        return "{}";
+    }
+
+    snapshot.tokens =
+        get_tokens(translation_unit, file_range, snapshot.file_name, annotate);
+    snapshot.contents = std::move(contents);
+    writer.append("{'full':1,'tokens':");
+    make_vimson_from_tokens(writer, snapshot.file_name, snapshot.tokens.begin(),
+                            snapshot.tokens.end(), annotate);
+    writer.append('}');
+    return writer.release();
+}
+
+void libclang_vim::clear_token_snapshots() {
+    std::lock_guard<std::mutex> lock(snapshots_mutex);
+    snapshots.clear();
 }
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -7,22 +7,66 @@
 #include <clang-c/Index.h>
 
 #include "helpers.hpp"
+#include "vimson_writer.hpp"
 
 namespace libclang_vim {
 
+/// A token of a file, copied out of libclang.
+class token_info {
+  public:
+    std::string spell;
+    CXTokenKind kind = CXToken_Punctuation;
+    unsigned line = 0;
+    unsigned column = 0;
+    unsigned offset = 0;
+    /// Offset just after the token.
+    unsigned end_offset = 0;
+    /// Set in annotated mode only, see clang_annotateTokens().
+    CXCursorKind cursor_kind = CXCursor_InvalidFile;
+    CXCursorKind referenced_kind = CXCursor_InvalidFile;
+    CXTypeKind type_kind = CXType_Invalid;
+
+    token_info();
+};
+
+/// Tokenizes files. With --vim-clang-annotate=1 each token also gets the
+/// kind of its cursor, of the declaration it references and of its type, so
+/// semantic highlighting needs a single call.
 class tokenizer {
     CXSourceRange
     get_range_whole_file(const location_tuple& tuple,
-                         const cxtranslation_unit_ptr& translation_unit) const;
+                         CXTranslationUnit translation_unit) const;
     const char* get_kind_spelling(CXTokenKind kind) const;
-    std::string
-    make_vimson_from_tokens(const cxtranslation_unit_ptr& translation_unit,
-                            std::vector<CXToken> tokens) const;
+    /// Tokenizes range, sets file_name to the name of the file of the tokens.
+    /// If annotate is set, the cursor of each token is looked up as well.
+    std::vector<token_info> get_tokens(CXTranslationUnit translation_unit,
+                                       CXSourceRange range,
+                                       std::string& file_name,
+                                       bool annotate) const;
+    void make_vimson_from_tokens(vimson_writer& writer,
+                                 const std::string& file_name,
+                                 std::vector<token_info>::const_iterator begin,
+                                 std::vector<token_info>::const_iterator end,
+                                 bool annotate) const;
 
   public:
     std::string tokenize_as_vimson(const location_tuple& tuple);
+
+    /// Tokenizes only the lines first_line..last_line, e.g. the visible part
+    /// of a window.
+    std::string tokenize_lines_as_vimson(const location_tuple& tuple,
+                                         unsigned first_line,
+                                         unsigned last_line);
+
+    /// Tokenizes only the lines which changed since the previous call with the
+    /// same file and arguments, and describes how to update the token list of
+    /// that call.
+    std::string tokenize_changes_as_vimson(const location_tuple& tuple);
 };
 
+/// Forgets the tokens remembered by tokenize_changes_as_vimson().
+void clear_token_snapshots();
+
 } // namespace libclang_vim
 
 #endif // LIBCLANG_VIM_TOKENIZER_HPP_INCLUDED
@@ -0,0 +1,335 @@
+#include "translation_unit_cache.hpp"
+
+#include <atomic>
+
+#include <sys/stat.h>
+
+namespace {
+
+/// Set from Vim's thread, read by the parse_queue worker too.
+std::atomic<libclang_vim::parse_profile>
+    default_parse_profile(libclang_vim::parse_profile::editing);
+
+#if CINDEX_VERSION_MINOR >= 64
+/// Like mkdir -p, errors are left to libclang when it writes there.
+void make_directories(const std::string& directory) {
+    for (std::size_t found = directory.find('/', 1); found != std::string::npos;
+         found = directory.find('/', found + 1))
+        mkdir(directory.substr(0, found).c_str(), 0700);
+    mkdir(directory.c_str(), 0700);
+}
+#endif
+
+using inclusion_stamps =
+    std::vector<std::pair<std::string, libclang_vim::file_stamp>>;
+
+void add_inclusion(CXFile included_file, CXSourceLocation* /*stack*/,
+                   unsigned include_length, CXClientData client_data) {
+    // The main file is stamped before the parse.
+    if (include_length == 0)
+        return;
+
+    libclang_vim::cxstring_ptr name = clang_getFileName(included_file);
+    const char* const file = libclang_vim::to_c_str(name);
+    auto& inclusions = *static_cast<inclusion_stamps*>(client_data);
+    inclusions.emplace_back(file, libclang_vim::get_file_stamp(file));
+}
+
+/// Stamps the headers included by translation_unit.
+inclusion_stamps get_inclusion_stamps(CXTranslationUnit translation_unit) {
+    inclusion_stamps inclusions;
+    clang_getInclusions(translation_unit, add_inclusion, &inclusions);
+    return inclusions;
+}
+
+bool inclusions_changed(const inclusion_stamps& inclusions) {
+    for (const auto& inclusion : inclusions) {
+        if (libclang_vim::get_file_stamp(inclusion.first) != inclusion.second)
+            return true;
+    }
+    return false;
+}
+}
+
+libclang_vim::cursor_handles::cursor_handles() = default;
+
+unsigned long libclang_vim::cursor_handles::add(CXCursor const& cursor) {
+    static std::atomic<unsigned long> last_handle(0);
+
+    unsigned const hash = clang_hashCursor(cursor);
+    auto const range = _by_hash.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (clang_equalCursors(_cursors.at(it->second), cursor))
+            return it->second;
+    }
+
+    unsigned long const handle = ++last_handle;
+    _cursors.emplace(handle, cursor);
+    _by_hash.emplace(hash, handle);
+    return handle;
+}
+
+bool libclang_vim::cursor_handles::get(unsigned long handle,
+                                       CXCursor& cursor) const {
+    auto const it = _cursors.find(handle);
+    if (it == _cursors.end())
+        return false;
+
+    cursor = it->second;
+    return true;
+}
+
+void libclang_vim::cursor_handles::clear() {
+    _cursors.clear();
+    _by_hash.clear();
+}
+
+libclang_vim::translation_unit_data::translation_unit_data() = default;
+
+void libclang_vim::translation_unit_data::clear() {
+    handles.clear();
+    tokens.clear();
+}
+
+libclang_vim::locked_translation_unit::locked_translation_unit()
+    : _unit(nullptr), _data(nullptr) {}
+
+libclang_vim::locked_translation_unit::locked_translation_unit(
+    std::shared_ptr<void> entry, std::unique_lock<std::mutex> lock,
+    CXTranslationUnit unit, translation_unit_data& data)
+    : _entry(std::move(entry)), _lock(std::move(lock)), _unit(unit),
+      _data(&data) {}
+
+libclang_vim::locked_translation_unit::locked_translation_unit(
+    locked_translation_unit&& other)
+    : _entry(std::move(other._entry)), _lock(std::move(other._lock)),
+      _unit(other._unit), _data(other._data) {
+    other._unit = nullptr;
+    other._data = nullptr;
+}
+
+libclang_vim::locked_translation_unit::operator CXTranslationUnit() const {
+    return _unit;
+}
+
+libclang_vim::translation_unit_data&
+libclang_vim::locked_translation_unit::data() const {
+    return *_data;
+}
+
+libclang_vim::translation_unit_cache::entry::entry() : unit(nullptr) {}
+
+libclang_vim::translation_unit_cache::translation_unit_cache() = default;
+
+std::shared_ptr<libclang_vim::cxindex_ptr>
+libclang_vim::translation_unit_cache::get_index() {
+    if (_index)
+        return _index;
+
+#if CINDEX_VERSION_MINOR >= 64
+    CXIndexOptions index_options{};
+    index_options.Size = sizeof(CXIndexOptions);
+    index_options.ExcludeDeclarationsFromPCH = 1;
+    index_options.DisplayDiagnostics = 0;
+    if (!_preamble_directory.empty()) {
+        index_options.StorePreamblesInMemory = 0;
+        index_options.PreambleStoragePath = _preamble_directory.c_str();
+    }
+    CXIndex index = clang_createIndexWithOptions(&index_options);
+#else
+    CXIndex index =
+        clang_createIndex(/*excludeDeclsFromPCH*/ 1, /*displayDiagnostics*/ 0);
+#endif
+    if (index)
+        _index = std::make_shared<cxindex_ptr>(index);
+    return _index;
+}
+
+libclang_vim::translation_unit_cache&
+libclang_vim::translation_unit_cache::instance() {
+    static translation_unit_cache cache;
+    return cache;
+}
+
+bool libclang_vim::translation_unit_cache::set_preamble_directory(
+    const std::string& directory) {
+#if CINDEX_VERSION_MINOR >= 64
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (directory == _preamble_directory)
+        return true;
+
+    make_directories(directory);
+    _preamble_directory = directory;
+    // Units in use keep the old index alive till they are released.
+    _entries.clear();
+    _index.reset();
+    return true;
+#else
+    (void)directory;
+    return false;
+#endif
+}
+
+void libclang_vim::translation_unit_cache::evict_least_recently_used() {
+    auto oldest = _entries.begin();
+    for (auto it = _entries.begin(); it != _entries.end(); ++it) {
+        if (it->second->last_use < oldest->second->last_use)
+            oldest = it;
+    }
+    if (oldest != _entries.end())
+        _entries.erase(oldest);
+}
+
+void libclang_vim::translation_unit_cache::remove(
+    const key_type& key, const std::shared_ptr<entry>& cached) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _entries.find(key);
+    if (it != _entries.end() && it->second == cached)
+        _entries.erase(it);
+}
+
+libclang_vim::locked_translation_unit
+libclang_vim::translation_unit_cache::get(const location_tuple& location_info,
+                                          unsigned options) {
+    key_type key{get_absolute_path(location_info.file), location_info.args,
+                 options};
+    std::shared_ptr<entry> cached;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _entries.find(key);
+        if (it != _entries.end()) {
+            cached = it->second;
+        } else {
+            auto index = get_index();
+            if (!index)
+                return locked_translation_unit();
+
+            if (_entries.size() >= max_entries)
+                evict_least_recently_used();
+            cached = std::make_shared<entry>();
+            cached->index = index;
+            _entries.emplace(key, cached);
+        }
+        cached->last_use = ++_use_counter;
+    }
+
+    // Only this unit is locked while parsing, other files can be used.
+    std::unique_lock<std::mutex> entry_lock(cached->mutex);
+    file_stamp const stamp = get_file_stamp(location_info.file);
+    std::vector<CXUnsavedFile> unsaved_files =
+        create_unsaved_files(location_info);
+
+    std::size_t const unsaved_size =
+        location_info.unsaved_file ? location_info.unsaved_file->size() : 0;
+    std::uint64_t const unsaved_hash =
+        location_info.unsaved_file
+            ? hash_bytes(location_info.unsaved_file->data(), unsaved_size)
+            : hash_bytes(nullptr, 0);
+
+    auto const parsed = [&]() {
+        cached->stamp = stamp;
+        cached->inclusions = get_inclusion_stamps(cached->unit);
+        cached->unsaved_size = unsaved_size;
+        cached->unsaved_hash = unsaved_hash;
+        cached->data.clear();
+        return locked_translation_unit(cached, std::move(entry_lock),
+                                       cached->unit, cached->data);
+    };
+
+    if (cached->unit) {
+        if (cached->stamp == stamp && cached->unsaved_size == unsaved_size &&
+            cached->unsaved_hash == unsaved_hash &&
+            !inclusions_changed(cached->inclusions))
+            return locked_translation_unit(cached, std::move(entry_lock),
+                                           cached->unit, cached->data);
+
+        // Something changed: reparse, which is much cheaper than a new parse.
+        if (clang_reparseTranslationUnit(
+                cached->unit, unsaved_files.size(), unsaved_files.data(),
+                clang_defaultReparseOptions(cached->unit)) == 0)
+            return parsed();
+
+        // The unit is unusable after a failed reparse.
+        cached->unit = cxtranslation_unit_ptr(nullptr);
+    }
+
+    auto const args_ptrs = get_args_ptrs(location_info.args);
+    cached->unit = cxtranslation_unit_ptr(clang_parseTranslationUnit(
+        *cached->index, location_info.file.c_str(), args_ptrs.data(),
+        args_ptrs.size(), unsaved_files.data(), unsaved_files.size(),
+        options));
+    if (!cached->unit) {
+        entry_lock.unlock();
+        remove(key, cached);
+        return locked_translation_unit();
+    }
+
+    return parsed();
+}
+
+void libclang_vim::translation_unit_cache::clear() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _entries.clear();
+    _index.reset();
+}
+
+const unsigned libclang_vim::preamble_options =
+    CXTranslationUnit_PrecompiledPreamble |
+    CXTranslationUnit_CacheCompletionResults
+#if CINDEX_VERSION_MINOR >= 35
+    | CXTranslationUnit_CreatePreambleOnFirstParse
+#endif
+    ;
+
+bool libclang_vim::parse_profile_from_name(const std::string& name,
+                                           parse_profile& profile) {
+    if (name == "incomplete")
+        profile = parse_profile::incomplete;
+    else if (name == "editing")
+        profile = parse_profile::editing;
+    else
+        return false;
+    return true;
+}
+
+const char* libclang_vim::get_parse_profile_name(parse_profile profile) {
+    switch (profile) {
+    case parse_profile::incomplete:
+        return "incomplete";
+    case parse_profile::editing:
+        return "editing";
+    }
+    return "";
+}
+
+void libclang_vim::set_default_parse_profile(parse_profile profile) {
+    default_parse_profile.store(profile);
+}
+
+libclang_vim::parse_profile libclang_vim::get_default_parse_profile() {
+    return default_parse_profile.load();
+}
+
+unsigned libclang_vim::get_parse_options(const location_tuple& location_info) {
+    parse_profile profile = default_parse_profile.load();
+    parse_profile_from_name(get_option(location_info, "profile"), profile);
+
+    unsigned options = CXTranslationUnit_Incomplete;
+    if (profile == parse_profile::editing)
+        options |= preamble_options;
+    return options;
+}
+
+libclang_vim::locked_translation_unit
+libclang_vim::parse_translation_unit(const location_tuple& location_info,
+                                     unsigned options) {
+    return translation_unit_cache::instance().get(location_info, options);
+}
+
+libclang_vim::locked_translation_unit
+libclang_vim::parse_translation_unit(const location_tuple& location_info) {
+    return parse_translation_unit(location_info,
+                                  get_parse_options(location_info));
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
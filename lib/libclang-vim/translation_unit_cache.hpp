@@ -0,0 +1,185 @@
+#if !defined LIBCLANG_VIM_TRANSLATION_UNIT_CACHE_HPP_INCLUDED
+#define LIBCLANG_VIM_TRANSLATION_UNIT_CACHE_HPP_INCLUDED
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <clang-c/Index.h>
+
+#include "helpers.hpp"
+#include "token_index.hpp"
+
+namespace libclang_vim {
+
+/// Cursors of a cached translation unit handed out as numbers, so that later
+/// calls can continue from them. Handles are unique in the process: the ones
+/// handed out before a reparse or by an evicted unit are just not found.
+class cursor_handles {
+    std::unordered_map<unsigned long, CXCursor> _cursors;
+    /// Handles by clang_hashCursor(), to hand out one handle per cursor.
+    std::unordered_multimap<unsigned, unsigned long> _by_hash;
+
+  public:
+    cursor_handles();
+
+    /// Never returns 0, which stands for the translation unit itself.
+    unsigned long add(CXCursor const& cursor);
+
+    /// Returns false if handle is unknown or outdated.
+    bool get(unsigned long handle, CXCursor& cursor) const;
+
+    /// Outdates all handles, needed when the unit is reparsed.
+    void clear();
+};
+
+/// Data derived from a cached translation unit, dropped when it's reparsed.
+class translation_unit_data {
+  public:
+    cursor_handles handles;
+    token_index tokens;
+
+    translation_unit_data();
+
+    void clear();
+};
+
+/// A translation unit owned by translation_unit_cache, locked for the
+/// lifetime of this object so that other threads don't reparse it meanwhile.
+class locked_translation_unit {
+    std::shared_ptr<void> _entry;
+    std::unique_lock<std::mutex> _lock;
+    CXTranslationUnit _unit;
+    translation_unit_data* _data;
+
+  public:
+    locked_translation_unit();
+
+    locked_translation_unit(std::shared_ptr<void> entry,
+                            std::unique_lock<std::mutex> lock,
+                            CXTranslationUnit unit,
+                            translation_unit_data& data);
+
+    locked_translation_unit(locked_translation_unit&& other);
+
+    operator CXTranslationUnit() const;
+
+    /// Data derived from this unit, only valid if the unit is.
+    translation_unit_data& data() const;
+};
+
+/// Keeps parsed translation units alive between libcall() invocations, so
+/// that only the first query on a file pays for a full parse. Can be used
+/// from multiple threads.
+class translation_unit_cache {
+    /// Absolute file name, compiler arguments and parse options.
+    using key_type = std::tuple<std::string, args_type, unsigned>;
+
+    struct entry {
+        /// Held while the unit is parsed or used.
+        std::mutex mutex;
+        /// Units have to be disposed before their index.
+        std::shared_ptr<cxindex_ptr> index;
+        cxtranslation_unit_ptr unit;
+        /// Size and hash of the unsaved buffer the unit was last parsed with.
+        /// A mapped buffer may change after the call, so it's not kept.
+        std::size_t unsaved_size = 0;
+        std::uint64_t unsaved_hash = 0;
+        /// The file the unit was last parsed with.
+        file_stamp stamp;
+        /// The headers the unit was last parsed with, by file name.
+        std::vector<std::pair<std::string, file_stamp>> inclusions;
+        unsigned long last_use = 0;
+        translation_unit_data data;
+
+        entry();
+    };
+
+    /// Guards the members below, but not the entries themselves.
+    std::mutex _mutex;
+    /// Shared by all units, so libclang's file and header caches are kept.
+    std::shared_ptr<cxindex_ptr> _index;
+    /// Where libclang stores precompiled preambles, empty for its default.
+    std::string _preamble_directory;
+    std::map<key_type, std::shared_ptr<entry>> _entries;
+    unsigned long _use_counter = 0;
+
+    translation_unit_cache();
+
+    /// Creates the index on first use, the caller must hold _mutex.
+    std::shared_ptr<cxindex_ptr> get_index();
+
+    void evict_least_recently_used();
+
+    /// Forgets about cached if it's still in the cache.
+    void remove(const key_type& key, const std::shared_ptr<entry>& cached);
+
+  public:
+    /// Number of translation units kept alive at the same time.
+    static const std::size_t max_entries = 8;
+
+    /// The process-wide cache, lives as long as the library is loaded.
+    static translation_unit_cache& instance();
+
+    /// Stores precompiled preambles in directory from now on. This drops all
+    /// cached units, as they belong to the current index. Returns false if
+    /// libclang is too old to support this.
+    bool set_preamble_directory(const std::string& directory);
+
+    /// Returns the translation unit of location_info, parses it on the first
+    /// call, reparses it if the file, its unsaved buffer or one of the headers
+    /// it includes changed since then.
+    /// Waits if an other thread is using the same unit.
+    locked_translation_unit get(const location_tuple& location_info,
+                                unsigned options);
+
+    /// Disposes all cached translation units which are not in use, and the
+    /// index once the ones in use are released.
+    void clear();
+};
+
+/// Named sets of options for clang_parseTranslationUnit().
+enum struct parse_profile {
+    /// Parse the whole file on every change.
+    incomplete = 0,
+    /// Build a precompiled preamble of the #include prefix on the first parse
+    /// and reuse it on reparse and code completion.
+    editing,
+};
+
+/// Options which build and reuse a precompiled preamble.
+extern const unsigned preamble_options;
+
+/// Parses "incomplete" or "editing", returns false for an unknown name.
+bool parse_profile_from_name(const std::string& name, parse_profile& profile);
+
+const char* get_parse_profile_name(parse_profile profile);
+
+/// Sets the profile used when a call has no --vim-clang-profile option.
+void set_default_parse_profile(parse_profile profile);
+
+parse_profile get_default_parse_profile();
+
+/// Options for clang_parseTranslationUnit(), based on the
+/// --vim-clang-profile option of location_info or the default profile.
+unsigned get_parse_options(const location_tuple& location_info);
+
+/// Wrapper around translation_unit_cache::get() using the process-wide cache.
+locked_translation_unit
+parse_translation_unit(const location_tuple& location_info, unsigned options);
+
+/// Same as above, using get_parse_options().
+locked_translation_unit
+parse_translation_unit(const location_tuple& location_info);
+
+} // namespace libclang_vim
+
+#endif // LIBCLANG_VIM_TRANSLATION_UNIT_CACHE_HPP_INCLUDED
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
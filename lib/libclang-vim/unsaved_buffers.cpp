@@ -0,0 +1,85 @@
+#include "unsaved_buffers.hpp"
+
+#include <algorithm>
+
+namespace {
+
+/// Offset of the first character of line (1-based), or the size of contents
+/// if it has less lines.
+std::size_t get_line_offset(const libclang_vim::unsaved_contents& contents,
+                            std::size_t line) {
+    const char* const end = contents.data() + contents.size();
+    const char* it = contents.data();
+    for (; line > 1 && it != end; --line) {
+        it = std::find(it, end, '\n');
+        if (it != end)
+            ++it;
+    }
+    return it - contents.data();
+}
+}
+
+libclang_vim::unsaved_buffers::unsaved_buffers() = default;
+
+libclang_vim::unsaved_buffers& libclang_vim::unsaved_buffers::instance() {
+    static unsaved_buffers buffers;
+    return buffers;
+}
+
+std::size_t
+libclang_vim::unsaved_buffers::update(const std::string& file,
+                                      std::vector<char> contents) {
+    auto buffer = std::make_shared<const unsaved_contents>(std::move(contents));
+    std::lock_guard<std::mutex> lock(_mutex);
+    _buffers[file] = buffer;
+    return buffer->size();
+}
+
+bool libclang_vim::unsaved_buffers::update_lines(const std::string& file,
+                                                 std::size_t first_line,
+                                                 std::size_t last_line,
+                                                 const std::string& text,
+                                                 std::size_t& size) {
+    if (first_line == 0 || last_line + 1 < first_line)
+        return false;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto const it = _buffers.find(file);
+    if (it == _buffers.end())
+        return false;
+
+    const unsaved_contents& old_buffer = *it->second;
+    std::size_t const begin = get_line_offset(old_buffer, first_line);
+    std::size_t const end = get_line_offset(old_buffer, last_line + 1);
+    std::vector<char> buffer;
+    buffer.reserve(old_buffer.size() - (end - begin) + text.size());
+    buffer.insert(buffer.end(), old_buffer.data(), old_buffer.data() + begin);
+    buffer.insert(buffer.end(), text.begin(), text.end());
+    buffer.insert(buffer.end(), old_buffer.data() + end,
+                  old_buffer.data() + old_buffer.size());
+    it->second = std::make_shared<const unsaved_contents>(std::move(buffer));
+    size = it->second->size();
+    return true;
+}
+
+libclang_vim::unsaved_contents_ptr
+libclang_vim::unsaved_buffers::get(const std::string& file) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto const it = _buffers.find(file);
+    if (it == _buffers.end())
+        return nullptr;
+
+    return it->second;
+}
+
+void libclang_vim::unsaved_buffers::remove(const std::string& file) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _buffers.erase(file);
+}
+
+void libclang_vim::unsaved_buffers::clear() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _buffers.clear();
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,55 @@
+#if !defined LIBCLANG_VIM_UNSAVED_BUFFERS_HPP_INCLUDED
+#define LIBCLANG_VIM_UNSAVED_BUFFERS_HPP_INCLUDED
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "helpers.hpp"
+
+namespace libclang_vim {
+
+/// Contents of modified Vim buffers, kept in memory so that they don't have to
+/// be written to a temporary file before each call. Files are identified by
+/// their absolute name.
+class unsaved_buffers {
+    std::mutex _mutex;
+    /// Never modified, an update replaces them, so calls using the previous
+    /// contents are not affected.
+    std::map<std::string, unsaved_contents_ptr> _buffers;
+
+    unsaved_buffers();
+
+  public:
+    unsaved_buffers(const unsaved_buffers&) = delete;
+    unsaved_buffers& operator=(const unsaved_buffers&) = delete;
+
+    static unsaved_buffers& instance();
+
+    /// Replaces the contents of file, returns the new size.
+    std::size_t update(const std::string& file, std::vector<char> contents);
+
+    /// Replaces the lines first_line..last_line (1-based) of file with text,
+    /// which is a list of complete lines. last_line is first_line - 1 for an
+    /// insertion. Returns false if file has no contents yet.
+    bool update_lines(const std::string& file, std::size_t first_line,
+                      std::size_t last_line, const std::string& text,
+                      std::size_t& size);
+
+    /// Returns the contents of file, nullptr if it has none.
+    unsaved_contents_ptr get(const std::string& file);
+
+    /// Forgets file, e.g. after it's written or its buffer is unloaded.
+    void remove(const std::string& file);
+
+    /// Forgets all files.
+    void clear();
+};
+
+} // namespace libclang_vim
+
+#endif // LIBCLANG_VIM_UNSAVED_BUFFERS_HPP_INCLUDED
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,183 @@
+#include "vimson_writer.hpp"
+
+#include <cstring>
+#include <utility>
+
+libclang_vim::symbol_table::symbol_table() = default;
+
+unsigned long libclang_vim::symbol_table::intern(const char* symbol) {
+    auto const inserted = _ids.emplace(symbol, _symbols.size());
+    if (inserted.second)
+        _symbols.push_back(&inserted.first->first);
+    return inserted.first->second;
+}
+
+void libclang_vim::symbol_table::write(vimson_writer& writer) const {
+    writer.append('[');
+    for (const std::string* symbol : _symbols)
+        writer.append('\'').append_escaped(symbol->c_str()).append("',");
+    writer.append(']');
+}
+
+libclang_vim::vimson_writer::vimson_writer() = default;
+
+libclang_vim::vimson_writer::vimson_writer(std::string buffer)
+    : _buffer(std::move(buffer)) {
+    _buffer.clear();
+}
+
+void libclang_vim::vimson_writer::reserve(std::size_t size) {
+    _buffer.reserve(size);
+}
+
+libclang_vim::vimson_writer&
+libclang_vim::vimson_writer::append(const char* s) {
+    if (s)
+        _buffer.append(s);
+    return *this;
+}
+
+libclang_vim::vimson_writer&
+libclang_vim::vimson_writer::append(const std::string& s) {
+    _buffer.append(s);
+    return *this;
+}
+
+libclang_vim::vimson_writer& libclang_vim::vimson_writer::append(char c) {
+    _buffer.push_back(c);
+    return *this;
+}
+
+libclang_vim::vimson_writer&
+libclang_vim::vimson_writer::append_number(unsigned long number) {
+    char digits[24];
+    char* end = digits + sizeof(digits);
+    char* begin = end;
+    do {
+        *--begin = static_cast<char>('0' + number % 10);
+        number /= 10;
+    } while (number);
+    _buffer.append(begin, end);
+    return *this;
+}
+
+libclang_vim::vimson_writer&
+libclang_vim::vimson_writer::append_escaped(const char* s) {
+    if (!s)
+        return *this;
+
+    while (const char* quote = std::strchr(s, '\'')) {
+        _buffer.append(s, quote + 1);
+        _buffer.push_back('\'');
+        s = quote + 1;
+    }
+    _buffer.append(s);
+    return *this;
+}
+
+libclang_vim::vimson_writer&
+libclang_vim::vimson_writer::append_key_value(const char* key,
+                                              const char* value) {
+    if (!value || !*value)
+        return *this;
+
+    _buffer.push_back('\'');
+    _buffer.append(key);
+    _buffer.append("':'");
+    append_escaped(value);
+    _buffer.append("',");
+    return *this;
+}
+
+void libclang_vim::vimson_writer::intern(symbol_table* files,
+                                         symbol_table* kinds) {
+    _files = files;
+    _kinds = kinds;
+}
+
+namespace {
+
+libclang_vim::vimson_writer& append_symbol(libclang_vim::vimson_writer& writer,
+                                           libclang_vim::symbol_table* table,
+                                           const char* key, const char* value) {
+    if (!table)
+        return writer.append_key_value(key, value);
+    if (!value || !*value)
+        return writer;
+
+    writer.append('\'').append(key).append("':");
+    return writer.append_number(table->intern(value)).append(',');
+}
+}
+
+libclang_vim::vimson_writer&
+libclang_vim::vimson_writer::append_file(const char* key,
+                                         const char* file_name) {
+    return append_symbol(*this, _files, key, file_name);
+}
+
+libclang_vim::vimson_writer&
+libclang_vim::vimson_writer::append_kind(const char* key, const char* kind) {
+    return append_symbol(*this, _kinds, key, kind);
+}
+
+std::size_t libclang_vim::vimson_writer::size() const { return _buffer.size(); }
+
+const std::string& libclang_vim::vimson_writer::str() const { return _buffer; }
+
+std::string libclang_vim::vimson_writer::release() {
+    std::string result;
+    result.swap(_buffer);
+    return result;
+}
+
+std::string libclang_vim::vimson_to_json(const std::string& vimson) {
+    std::string json;
+    json.reserve(vimson.size());
+
+    const std::size_t size = vimson.size();
+    for (std::size_t i = 0; i < size; ++i) {
+        const char c = vimson[i];
+        if (c == '\'') {
+            json.push_back('"');
+            for (++i; i < size; ++i) {
+                const unsigned char s = vimson[i];
+                if (s == '\'') {
+                    // '' is an escaped quote, a single one ends the string.
+                    if (i + 1 < size && vimson[i + 1] == '\'') {
+                        json.push_back('\'');
+                        ++i;
+                        continue;
+                    }
+                    break;
+                }
+                if (s == '"' || s == '\\') {
+                    json.push_back('\\');
+                    json.push_back(s);
+                } else if (s < 0x20) {
+                    static const char hex[] = "0123456789abcdef";
+                    json.append("\\u00");
+                    json.push_back(hex[s >> 4]);
+                    json.push_back(hex[s & 0xf]);
+                } else {
+                    json.push_back(s);
+                }
+            }
+            json.push_back('"');
+        } else if (c == ',') {
+            // JSON has no trailing commas.
+            std::size_t next = i + 1;
+            while (next < size && vimson[next] == ' ')
+                ++next;
+            if (next < size && (vimson[next] == ']' || vimson[next] == '}'))
+                continue;
+            json.push_back(c);
+        } else {
+            json.push_back(c);
+        }
+    }
+
+    return json;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
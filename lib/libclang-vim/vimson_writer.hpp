@@ -0,0 +1,85 @@
+#if !defined LIBCLANG_VIM_VIMSON_WRITER_HPP_INCLUDED
+#define LIBCLANG_VIM_VIMSON_WRITER_HPP_INCLUDED
+
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace libclang_vim {
+
+class vimson_writer;
+
+/// Gives each distinct string a small id, in the order of first use.
+class symbol_table {
+    std::unordered_map<std::string, unsigned long> _ids;
+    /// Keys of _ids by id.
+    std::vector<const std::string*> _symbols;
+
+  public:
+    symbol_table();
+
+    unsigned long intern(const char* symbol);
+
+    /// Appends the symbols as a list, indexed by their ids.
+    void write(vimson_writer& writer) const;
+};
+
+/// Append-only output buffer for vimson, so that large results are built
+/// without copying the already written part again and again.
+class vimson_writer {
+    std::string _buffer;
+    symbol_table* _files = nullptr;
+    symbol_table* _kinds = nullptr;
+
+  public:
+    vimson_writer();
+
+    /// Writes into buffer after clearing it, to reuse its capacity.
+    explicit vimson_writer(std::string buffer);
+
+    void reserve(std::size_t size);
+
+    /// Appends s as-is, nullptr is treated as an empty string.
+    vimson_writer& append(const char* s);
+
+    vimson_writer& append(const std::string& s);
+
+    vimson_writer& append(char c);
+
+    vimson_writer& append_number(unsigned long number);
+
+    /// Appends s with single quotes doubled, as required inside a '...' Vim
+    /// string.
+    vimson_writer& append_escaped(const char* s);
+
+    /// Appends 'key':'value', if value is not empty.
+    vimson_writer& append_key_value(const char* key, const char* value);
+
+    /// Makes append_file() and append_kind() write ids from these tables
+    /// instead of the strings, for output which repeats them a lot.
+    void intern(symbol_table* files, symbol_table* kinds);
+
+    /// Appends 'key':'file name', or 'key':id when interning.
+    vimson_writer& append_file(const char* key, const char* file_name);
+
+    /// Appends 'key':'kind spelling', or 'key':id when interning.
+    vimson_writer& append_kind(const char* key, const char* kind);
+
+    std::size_t size() const;
+
+    const std::string& str() const;
+
+    /// Moves the written vimson out of the writer.
+    std::string release();
+};
+
+/// Converts vimson to strict JSON, suitable for json_decode(): strings get
+/// double quotes and trailing commas are removed. Takes linear time.
+std::string vimson_to_json(const std::string& vimson);
+
+} // namespace libclang_vim
+
+#endif // LIBCLANG_VIM_VIMSON_WRITER_HPP_INCLUDED
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
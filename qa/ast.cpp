@@ -8,10 +8,24 @@ class ast_test : public CPPUNIT_NS::TestFixture {
     CPPUNIT_TEST_SUITE(ast_test);
     CPPUNIT_TEST(test_extract_declarations_current_file);
     CPPUNIT_TEST(test_unsaved_extract_declarations_current_file);
+    CPPUNIT_TEST(test_interned_extract_declarations_current_file);
+    CPPUNIT_TEST(test_paged_extract_declarations_current_file);
+    CPPUNIT_TEST(test_children_of_current_file);
+    CPPUNIT_TEST(test_extract_virtual_member_functions_current_file);
+    CPPUNIT_TEST(test_query);
+    CPPUNIT_TEST(test_fields_extract_declarations_current_file);
+    CPPUNIT_TEST(test_literal_values);
     CPPUNIT_TEST_SUITE_END();
 
     void test_extract_declarations_current_file();
     void test_unsaved_extract_declarations_current_file();
+    void test_interned_extract_declarations_current_file();
+    void test_paged_extract_declarations_current_file();
+    void test_children_of_current_file();
+    void test_extract_virtual_member_functions_current_file();
+    void test_query();
+    void test_fields_extract_declarations_current_file();
+    void test_literal_values();
 
     void* m_handle = nullptr;
 
@@ -63,6 +77,145 @@ void ast_test::test_unsaved_extract_declarations_current_file() {
     CPPUNIT_ASSERT(actual != "{'root':[]}");
 }
 
+void ast_test::test_interned_extract_declarations_current_file() {
+    auto vim_clang_extract_declarations_current_file =
+        reinterpret_cast<char const* (*)(char const*)>(
+            dlsym(m_handle, "vim_clang_extract_declarations_current_file"));
+    assert(vim_clang_extract_declarations_current_file);
+
+    std::string actual(vim_clang_extract_declarations_current_file(
+        "qa/data/declaration.cpp:-std=c++1y --vim-clang-intern=1"));
+    // Nodes refer to the file by its id.
+    CPPUNIT_ASSERT(actual.find("'file':0,") != std::string::npos);
+    CPPUNIT_ASSERT(actual.find("'file':'") == std::string::npos);
+    CPPUNIT_ASSERT(actual.find(",'files':['qa/data/declaration.cpp',],"
+                               "'kinds':[") != std::string::npos);
+}
+
+void ast_test::test_paged_extract_declarations_current_file() {
+    auto vim_clang_extract_declarations_current_file =
+        reinterpret_cast<char const* (*)(char const*)>(
+            dlsym(m_handle, "vim_clang_extract_declarations_current_file"));
+    assert(vim_clang_extract_declarations_current_file);
+
+    // The first page has the namespace and the class in it.
+    std::string actual(vim_clang_extract_declarations_current_file(
+        "qa/data/declaration.cpp:-std=c++1y --vim-clang-max-nodes=2"));
+    CPPUNIT_ASSERT(actual.find("'id':1,") != std::string::npos);
+    CPPUNIT_ASSERT(actual.find("'next':2}") != std::string::npos);
+
+    // The second page starts inside the class.
+    actual = vim_clang_extract_declarations_current_file(
+        "qa/data/declaration.cpp:-std=c++1y --vim-clang-max-nodes=2 "
+        "--vim-clang-start=2");
+    CPPUNIT_ASSERT(actual.find("'id':1,") == std::string::npos);
+    CPPUNIT_ASSERT(actual.find("'id':2,'parent_id':1,") != std::string::npos);
+    CPPUNIT_ASSERT(actual.find("'next':4}") != std::string::npos);
+}
+
+void ast_test::test_children_of_current_file() {
+    auto vim_clang_children_of_current_file =
+        reinterpret_cast<char const* (*)(char const*)>(
+            dlsym(m_handle, "vim_clang_children_of_current_file"));
+    assert(vim_clang_children_of_current_file);
+
+    // The top level has the namespace and main().
+    std::string actual(vim_clang_children_of_current_file(
+        "qa/data/declaration.cpp:-std=c++1y:0"));
+    CPPUNIT_ASSERT(actual.find("'spell':'ns'") != std::string::npos);
+    CPPUNIT_ASSERT(actual.find("'spell':'main'") != std::string::npos);
+    CPPUNIT_ASSERT(actual.find("'spell':'C'") == std::string::npos);
+
+    // Expanding the namespace gives the class only.
+    std::string const key("'handle':");
+    std::size_t const pos = actual.find(key);
+    CPPUNIT_ASSERT(pos != std::string::npos);
+    std::string const handle(actual.substr(
+        pos + key.size(), actual.find(',', pos) - pos - key.size()));
+    actual = vim_clang_children_of_current_file(
+        ("qa/data/declaration.cpp:-std=c++1y:" + handle).c_str());
+    CPPUNIT_ASSERT(actual.find("'spell':'C'") != std::string::npos);
+    CPPUNIT_ASSERT(actual.find("'spell':'foo'") == std::string::npos);
+
+    // Unknown handles give nothing.
+    CPPUNIT_ASSERT_EQUAL(std::string("{}"),
+                         std::string(vim_clang_children_of_current_file(
+                             "qa/data/declaration.cpp:-std=c++1y:123456")));
+}
+
+void ast_test::test_extract_virtual_member_functions_current_file() {
+    auto extract_virtual_member_functions =
+        reinterpret_cast<char const* (*)(char const*)>(dlsym(
+            m_handle,
+            "vim_clang_extract_virtual_member_functions_current_file"));
+    assert(extract_virtual_member_functions);
+
+    // Skipping expressions must not miss local classes, even in lambdas.
+    std::string actual(extract_virtual_member_functions(
+        "qa/data/member-functions.cpp:-std=c++1y"));
+    CPPUNIT_ASSERT(actual.find("'spell':'f'") != std::string::npos);
+    CPPUNIT_ASSERT(actual.find("'spell':'h'") != std::string::npos);
+    CPPUNIT_ASSERT(actual.find("'spell':'i'") != std::string::npos);
+    // A lambda passed as a call argument.
+    CPPUNIT_ASSERT(actual.find("'spell':'k'") != std::string::npos);
+}
+
+void ast_test::test_query() {
+    auto vim_clang_query = reinterpret_cast<char const* (*)(char const*)>(
+        dlsym(m_handle, "vim_clang_query"));
+    assert(vim_clang_query);
+
+    std::string actual(
+        vim_clang_query("qa/data/member-functions.cpp:-std=c++1y:"
+                        "in_main_file && is_virtual && name=~'^[fh]$'"));
+    CPPUNIT_ASSERT(actual.find("'spell':'f'") != std::string::npos);
+    CPPUNIT_ASSERT(actual.find("'spell':'h'") != std::string::npos);
+    CPPUNIT_ASSERT(actual.find("'spell':'i'") == std::string::npos);
+
+    // Local classes in lambdas nested in other expressions are not skipped.
+    actual = vim_clang_query("qa/data/member-functions.cpp:-std=c++1y:"
+                             "is_virtual && name=~'^k$'");
+    CPPUNIT_ASSERT(actual.find("'spell':'k'") != std::string::npos);
+
+    // Invalid expressions give nothing.
+    CPPUNIT_ASSERT_EQUAL(
+        std::string("{}"),
+        std::string(vim_clang_query(
+            "qa/data/member-functions.cpp:-std=c++1y:is_virtual &&")));
+}
+
+void ast_test::test_fields_extract_declarations_current_file() {
+    auto vim_clang_extract_declarations_current_file =
+        reinterpret_cast<char const* (*)(char const*)>(
+            dlsym(m_handle, "vim_clang_extract_declarations_current_file"));
+    assert(vim_clang_extract_declarations_current_file);
+
+    std::string actual(vim_clang_extract_declarations_current_file(
+        "qa/data/declaration.cpp:-std=c++1y --vim-clang-fields=spell,kind"));
+    CPPUNIT_ASSERT(actual.find("{'spell':'ns','kind':'Namespace',"
+                               "'kind_type':'Declaration','children':[") !=
+                   std::string::npos);
+    CPPUNIT_ASSERT(actual.find("'line':") == std::string::npos);
+    CPPUNIT_ASSERT(actual.find("'type':") == std::string::npos);
+}
+
+void ast_test::test_literal_values() {
+    auto vim_clang_extract_expressions_current_file =
+        reinterpret_cast<char const* (*)(char const*)>(
+            dlsym(m_handle, "vim_clang_extract_expressions_current_file"));
+    assert(vim_clang_extract_expressions_current_file);
+
+    // The value is the spelling of the last token of the literal.
+    std::string actual(vim_clang_extract_expressions_current_file(
+        "qa/data/literals.cpp:--vim-clang-fields=value"));
+    CPPUNIT_ASSERT(actual.find("{'value': '1','children':[]}") !=
+                   std::string::npos);
+    CPPUNIT_ASSERT(actual.find("{'value': '0x2','children':[]}") !=
+                   std::string::npos);
+    CPPUNIT_ASSERT(actual.find("{'value': '\"y\"','children':[]}") !=
+                   std::string::npos);
+}
+
 CPPUNIT_TEST_SUITE_REGISTRATION(ast_test);
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1 @@
+const char* name = NAME;
@@ -0,0 +1,4 @@
+int a[] = {1, 0x2, 3};
+const char* s = "x" "y";
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
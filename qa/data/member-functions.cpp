@@ -0,0 +1,28 @@
+class A {
+  public:
+    virtual void f();
+};
+
+void g() {
+    class B {
+      public:
+        virtual void h() {}
+    };
+    auto l = [] {
+        struct C {
+            virtual void i() {}
+        };
+    };
+}
+
+template <typename F> void call(F f) { f(); }
+
+void j() {
+    call([] {
+        struct D {
+            virtual void k() {}
+        };
+    });
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1 @@
+const char* s = "it's";
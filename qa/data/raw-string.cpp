@@ -0,0 +1,5 @@
+int a;
+const char* s = R"x(
+int b;
+)x";
+int c;
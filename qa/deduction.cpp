@@ -1,7 +1,13 @@
 #include <cassert>
 #include <cppunit/extensions/HelperMacros.h>
+#include <cstdio>
+#include <cstdlib>
 #include <dlfcn.h>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <sys/stat.h>
+#include <thread>
 #include <unistd.h>
 
 class deduction_test : public CPPUNIT_NS::TestFixture {
@@ -14,6 +20,10 @@ class deduction_test : public CPPUNIT_NS::TestFixture {
     CPPUNIT_TEST(test_unsaved_current_function_at);
     CPPUNIT_TEST(test_completion_at);
     CPPUNIT_TEST(test_unsaved_completion_at);
+    CPPUNIT_TEST(test_completion_at_incomplete_profile);
+    CPPUNIT_TEST(test_ranked_completion_at);
+    CPPUNIT_TEST(test_completion_while_typing);
+    CPPUNIT_TEST(test_completion_detail);
     CPPUNIT_TEST(test_comment_at);
     CPPUNIT_TEST(test_unsaved_comment_at);
     CPPUNIT_TEST(test_declaration_at);
@@ -23,7 +33,16 @@ class deduction_test : public CPPUNIT_NS::TestFixture {
     CPPUNIT_TEST(test_unsaved_include_at);
     CPPUNIT_TEST(test_diagnostics);
     CPPUNIT_TEST(test_unsaved_diagnostics);
+    CPPUNIT_TEST(test_reparse_diagnostics);
+    CPPUNIT_TEST(test_reparse_header_change);
+    CPPUNIT_TEST(test_parse_async);
     CPPUNIT_TEST(test_full_name_at);
+    CPPUNIT_TEST(test_batch);
+    CPPUNIT_TEST(test_retain_results);
+    CPPUNIT_TEST(test_threads);
+    CPPUNIT_TEST(test_json_format);
+    CPPUNIT_TEST(test_shutdown);
+    CPPUNIT_TEST(test_preamble_directory);
     CPPUNIT_TEST_SUITE_END();
 
     void test_get_type_with_deduction_at();
@@ -34,6 +53,10 @@ class deduction_test : public CPPUNIT_NS::TestFixture {
     void test_unsaved_current_function_at();
     void test_completion_at();
     void test_unsaved_completion_at();
+    void test_completion_at_incomplete_profile();
+    void test_ranked_completion_at();
+    void test_completion_while_typing();
+    void test_completion_detail();
     void test_comment_at();
     void test_unsaved_comment_at();
     void test_declaration_at();
@@ -43,7 +66,16 @@ class deduction_test : public CPPUNIT_NS::TestFixture {
     void test_unsaved_include_at();
     void test_diagnostics();
     void test_unsaved_diagnostics();
+    void test_reparse_diagnostics();
+    void test_reparse_header_change();
+    void test_parse_async();
     void test_full_name_at();
+    void test_batch();
+    void test_retain_results();
+    void test_threads();
+    void test_json_format();
+    void test_shutdown();
+    void test_preamble_directory();
 
     void* m_handle = nullptr;
 
@@ -190,6 +222,118 @@ void deduction_test::test_unsaved_completion_at() {
     CPPUNIT_ASSERT_EQUAL(expected, actual);
 }
 
+void deduction_test::test_completion_at_incomplete_profile() {
+    auto vim_clang_get_completion_at =
+        reinterpret_cast<char const* (*)(char const*)>(
+            dlsym(m_handle, "vim_clang_get_completion_at"));
+    assert(vim_clang_get_completion_at);
+
+    // The option selects the parse options, it's not a compiler argument.
+    std::string expected("['C', 'bar', 'foo', 'operator=', '~C']");
+    std::string actual(vim_clang_get_completion_at(
+        "qa/data/completion.cpp:-std=c++1y "
+        "--vim-clang-profile=incomplete:16:7"));
+    CPPUNIT_ASSERT_EQUAL(expected, actual);
+}
+
+void deduction_test::test_ranked_completion_at() {
+    auto vim_clang_get_completion_at =
+        reinterpret_cast<char const* (*)(char const*)>(
+            dlsym(m_handle, "vim_clang_get_completion_at"));
+    assert(vim_clang_get_completion_at);
+
+    // Prefix matches first, then the ones containing the typed text.
+    std::string expected("['operator=', 'foo']");
+    std::string actual(vim_clang_get_completion_at(
+        "qa/data/completion.cpp:-std=c++1y --vim-clang-prefix=O:16:7"));
+    CPPUNIT_ASSERT_EQUAL(expected, actual);
+
+    expected = "['operator=']";
+    actual = vim_clang_get_completion_at("qa/data/completion.cpp:-std=c++1y "
+                                         "--vim-clang-prefix=O "
+                                         "--vim-clang-limit=1:16:7");
+    CPPUNIT_ASSERT_EQUAL(expected, actual);
+}
+
+void deduction_test::test_completion_while_typing() {
+    using function_type = char const* (*)(char const*);
+    auto vim_clang_get_completion_items_at = reinterpret_cast<function_type>(
+        dlsym(m_handle, "vim_clang_get_completion_items_at"));
+    assert(vim_clang_get_completion_items_at);
+    auto update_buffer = reinterpret_cast<function_type>(
+        dlsym(m_handle, "vim_clang_update_buffer"));
+    assert(update_buffer);
+    auto drop_buffer = reinterpret_cast<function_type>(
+        dlsym(m_handle, "vim_clang_drop_buffer"));
+    assert(drop_buffer);
+
+    std::ifstream stream("qa/data/completion.cpp");
+    std::string contents((std::istreambuf_iterator<char>(stream)),
+                         std::istreambuf_iterator<char>());
+    std::string const member = "    c.\n";
+    std::size_t const pos = contents.find(member);
+    CPPUNIT_ASSERT(pos != std::string::npos);
+
+    // Returns the session id of the completions after typed.
+    auto const complete = [&](const std::string& typed,
+                              const std::string& suffix) {
+        std::string buffer = contents + suffix;
+        buffer.insert(pos + member.size() - 1, typed);
+        update_buffer(("qa/data/completion.cpp:" + buffer).c_str());
+        std::string const location =
+            "qa/data/completion.cpp:-std=c++1y --vim-clang-prefix=" + typed +
+            ":16:" + std::to_string(7 + typed.size());
+        std::string const items(
+            vim_clang_get_completion_items_at(location.c_str()));
+        CPPUNIT_ASSERT(items.find("'word':'foo'") != std::string::npos);
+        unsigned long session = 0;
+        CPPUNIT_ASSERT_EQUAL(
+            1, std::sscanf(items.c_str(), "{'session':%lu,", &session));
+        return session;
+    };
+
+    // The completions at the start of "f", "fo", ... are the same session.
+    unsigned long const session = complete("f", "");
+    CPPUNIT_ASSERT_EQUAL(session, complete("fo", ""));
+    CPPUNIT_ASSERT_EQUAL(session, complete("foo", ""));
+
+    // An edit outside the identifier needs a new completion.
+    CPPUNIT_ASSERT(complete("foo", "int z;\n") != session);
+    drop_buffer("qa/data/completion.cpp");
+}
+
+void deduction_test::test_completion_detail() {
+    using function_type = char const* (*)(char const*);
+    auto vim_clang_get_completion_items_at = reinterpret_cast<function_type>(
+        dlsym(m_handle, "vim_clang_get_completion_items_at"));
+    assert(vim_clang_get_completion_items_at);
+    auto vim_clang_completion_detail = reinterpret_cast<function_type>(
+        dlsym(m_handle, "vim_clang_completion_detail"));
+    assert(vim_clang_completion_detail);
+
+    std::string const items(vim_clang_get_completion_items_at(
+        "qa/data/completion.cpp:-std=c++1y --vim-clang-prefix=foo "
+        "--vim-clang-limit=1:16:7"));
+    unsigned long session = 0;
+    unsigned index = 0;
+    CPPUNIT_ASSERT_EQUAL(2, std::sscanf(items.c_str(),
+                                        "{'session':%lu,'items':[{'index':%u,",
+                                        &session, &index));
+    CPPUNIT_ASSERT(items.find("'word':'foo','kind':'CXXMethod',") !=
+                   std::string::npos);
+
+    // The details are read from the kept results.
+    std::string const detail(vim_clang_completion_detail(
+        (std::to_string(session) + ":" + std::to_string(index)).c_str()));
+    CPPUNIT_ASSERT(detail.find("'signature':'foo(int x)','result_type':'int',"
+                               "'parameters':['int x',],") !=
+                   std::string::npos);
+
+    std::string const unknown(vim_clang_completion_detail(
+        (std::to_string(session + 1000) + ":0").c_str()));
+    CPPUNIT_ASSERT_EQUAL(std::string("{}"), unknown);
+}
+
 void deduction_test::test_comment_at() {
     auto vim_clang_get_completion_at =
         reinterpret_cast<char const* (*)(char const*)>(
@@ -256,6 +400,44 @@ void deduction_test::test_compile_commands() {
     std::string actual(vim_clang_get_compile_commands(
         SRC_ROOT "/qa/data/compile-commands/test.cpp:"));
     CPPUNIT_ASSERT_EQUAL(expected, actual);
+    // Now from the cache.
+    actual = vim_clang_get_compile_commands(
+        SRC_ROOT "/qa/data/compile-commands/test.cpp:");
+    CPPUNIT_ASSERT_EQUAL(expected, actual);
+
+    // No JSON, but compile_flags.txt.
+    expected = "{'commands':'-DBAR -std=c++11'}";
+    actual = vim_clang_get_compile_commands("qa/data/compile-flags/test.cpp:");
+    CPPUNIT_ASSERT_EQUAL(expected, actual);
+
+    // Quoted, so that passing the commands back keeps -DNAME="x" intact.
+    expected = "{'commands':'''-DNAME=\"x\"'' -std=c++11'}";
+    actual =
+        vim_clang_get_compile_commands("qa/data/compile-quoted/test.cpp:");
+    CPPUNIT_ASSERT_EQUAL(expected, actual);
+
+    auto vim_clang_get_diagnostics =
+        reinterpret_cast<char const* (*)(char const*)>(
+            dlsym(m_handle, "vim_clang_get_diagnostics"));
+    assert(vim_clang_get_diagnostics);
+    actual = vim_clang_get_diagnostics(
+        "qa/data/compile-quoted/test.cpp:'-DNAME=\"x\"' -std=c++11");
+    CPPUNIT_ASSERT_EQUAL(std::string("[]"), actual);
+
+    // Rewritten with the same size, likely within the same second.
+    char directory[] = "/tmp/libclang-vim-XXXXXX";
+    CPPUNIT_ASSERT(mkdtemp(directory));
+    std::string const flags = std::string(directory) + "/compile_flags.txt";
+    std::string const file = std::string(directory) + "/test.cpp:";
+    std::ofstream(flags.c_str()) << "-DA\n";
+    CPPUNIT_ASSERT_EQUAL(
+        std::string("{'commands':'-DA'}"),
+        std::string(vim_clang_get_compile_commands(file.c_str())));
+    std::ofstream(flags.c_str()) << "-DB\n";
+    actual = vim_clang_get_compile_commands(file.c_str());
+    std::remove(flags.c_str());
+    rmdir(directory);
+    CPPUNIT_ASSERT_EQUAL(std::string("{'commands':'-DB'}"), actual);
 }
 
 void deduction_test::test_include_at() {
@@ -270,6 +452,12 @@ void deduction_test::test_include_at() {
         "qa/data/compile-commands/test.cpp:-std=c++1y -I" SRC_ROOT
         "/qa/data/compile-commands/:1:2"));
     CPPUNIT_ASSERT_EQUAL(expected, actual);
+
+    // The include path comes from compile_commands.json.
+    actual = vim_clang_get_include_at(SRC_ROOT
+                                      "/qa/data/compile-commands/test.cpp:"
+                                      "--vim-clang-args=auto:1:2");
+    CPPUNIT_ASSERT_EQUAL(expected, actual);
 }
 
 void deduction_test::test_unsaved_include_at() {
@@ -318,6 +506,91 @@ void deduction_test::test_unsaved_diagnostics() {
     CPPUNIT_ASSERT_EQUAL(expected, actual);
 }
 
+void deduction_test::test_reparse_diagnostics() {
+    auto vim_clang_get_diagnostics =
+        reinterpret_cast<char const* (*)(char const*)>(
+            dlsym(m_handle, "vim_clang_get_diagnostics"));
+    assert(vim_clang_get_diagnostics);
+
+    std::string expected("[{'severity': 'warning', "
+                         "'line':1,'column':18,'offset':17,'file':'diagnostics."
+                         "cpp',}, ]");
+    chdir("qa/data/unsaved");
+    std::string actual(vim_clang_get_diagnostics(
+        "diagnostics.cpp#diagnostics-unsaved.cpp:-Wunused-variable"));
+    CPPUNIT_ASSERT_EQUAL(expected, actual);
+
+    // The cached translation unit has to be reparsed when the buffer changes,
+    // the saved version of the file is empty.
+    actual = vim_clang_get_diagnostics("diagnostics.cpp:-Wunused-variable");
+    CPPUNIT_ASSERT_EQUAL(std::string("[]"), actual);
+
+    actual = vim_clang_get_diagnostics(
+        "diagnostics.cpp#diagnostics-unsaved.cpp:-Wunused-variable");
+    chdir("../../..");
+    CPPUNIT_ASSERT_EQUAL(expected, actual);
+}
+
+void deduction_test::test_reparse_header_change() {
+    auto vim_clang_get_diagnostics =
+        reinterpret_cast<char const* (*)(char const*)>(
+            dlsym(m_handle, "vim_clang_get_diagnostics"));
+    assert(vim_clang_get_diagnostics);
+
+    char directory[] = "/tmp/libclang-vim-XXXXXX";
+    CPPUNIT_ASSERT(mkdtemp(directory));
+    std::string const header = std::string(directory) + "/header.h";
+    std::string const file = std::string(directory) + "/main.cpp";
+    std::ofstream(header.c_str()) << "int x;\n";
+    std::ofstream(file.c_str()) << "#include \"header.h\"\nint y = x;\n";
+    std::string const arguments = file + ":-std=c++1y";
+    CPPUNIT_ASSERT_EQUAL(
+        std::string("[]"),
+        std::string(vim_clang_get_diagnostics(arguments.c_str())));
+
+    // Only the header changes, the cached unit still has to be reparsed.
+    std::ofstream(header.c_str()) << "\n";
+    std::string const actual(vim_clang_get_diagnostics(arguments.c_str()));
+    std::remove(header.c_str());
+    std::remove(file.c_str());
+    rmdir(directory);
+    CPPUNIT_ASSERT(actual.find("'severity': 'error'") != std::string::npos);
+}
+
+void deduction_test::test_parse_async() {
+    auto vim_clang_parse_async = reinterpret_cast<char const* (*)(char const*)>(
+        dlsym(m_handle, "vim_clang_parse_async"));
+    assert(vim_clang_parse_async);
+    auto vim_clang_poll = reinterpret_cast<char const* (*)(char const*)>(
+        dlsym(m_handle, "vim_clang_poll"));
+    assert(vim_clang_poll);
+    auto vim_clang_get_diagnostics =
+        reinterpret_cast<char const* (*)(char const*)>(
+            dlsym(m_handle, "vim_clang_get_diagnostics"));
+    assert(vim_clang_get_diagnostics);
+
+    std::string ticket(
+        vim_clang_parse_async("qa/data/diagnostics.cpp:-Wunused-variable"));
+    std::string status;
+    for (int i = 0; i < 1000; ++i) {
+        status = vim_clang_poll(ticket.c_str());
+        if (status != "'pending'")
+            break;
+        usleep(10000);
+    }
+    CPPUNIT_ASSERT_EQUAL(std::string("{'status':'ready'}"), status);
+    // Finished tickets are forgotten.
+    CPPUNIT_ASSERT_EQUAL(std::string("{}"),
+                         std::string(vim_clang_poll(ticket.c_str())));
+
+    std::string expected("[{'severity': 'warning', "
+                         "'line':1,'column':18,'offset':17,'file':'qa/data/"
+                         "diagnostics.cpp',}, ]");
+    std::string actual(
+        vim_clang_get_diagnostics("qa/data/diagnostics.cpp:-Wunused-variable"));
+    CPPUNIT_ASSERT_EQUAL(expected, actual);
+}
+
 void deduction_test::test_full_name_at() {
     auto vim_clang_get_full_name_at =
         reinterpret_cast<char const* (*)(char const*)>(
@@ -330,6 +603,152 @@ void deduction_test::test_full_name_at() {
     CPPUNIT_ASSERT_EQUAL(expected, actual);
 }
 
+void deduction_test::test_batch() {
+    auto vim_clang_batch = reinterpret_cast<char const* (*)(char const*)>(
+        dlsym(m_handle, "vim_clang_batch"));
+    assert(vim_clang_batch);
+
+    // One parse answers all queries, unknown APIs give an empty result.
+    std::string expected("[{'name':'ns::C::foo'},{'brief':'This is foo.'},"
+                         "{'name':'E::foo'},{},]");
+    std::string actual(vim_clang_batch(
+        "qa/data/current-function.cpp:-std=c++1y:"
+        "vim_clang_get_current_function_at:10:1;"
+        "vim_clang_get_comment_at:37:8;vim_clang_get_full_name_at:37:8;"
+        "vim_clang_no_such_api:1:1"));
+    CPPUNIT_ASSERT_EQUAL(expected, actual);
+}
+
+void deduction_test::test_retain_results() {
+    auto vim_clang_retain_results =
+        reinterpret_cast<char const* (*)(char const*)>(
+            dlsym(m_handle, "vim_clang_retain_results"));
+    assert(vim_clang_retain_results);
+    auto vim_clang_free_result = reinterpret_cast<char const* (*)(char const*)>(
+        dlsym(m_handle, "vim_clang_free_result"));
+    assert(vim_clang_free_result);
+    auto vim_clang_get_current_function_at =
+        reinterpret_cast<char const* (*)(char const*)>(
+            dlsym(m_handle, "vim_clang_get_current_function_at"));
+    assert(vim_clang_get_current_function_at);
+
+    CPPUNIT_ASSERT_EQUAL(std::string("{'retain':1}"),
+                         std::string(vim_clang_retain_results("1")));
+    const char* first = vim_clang_get_current_function_at(
+        "qa/data/current-function.cpp:-std=c++1y:10:1");
+    const char* second = vim_clang_get_current_function_at(
+        "qa/data/current-function.cpp:-std=c++1y:20:9");
+    // The second call doesn't overwrite the first result.
+    CPPUNIT_ASSERT_EQUAL(std::string("{'name':'ns::C::foo'}"),
+                         std::string(first));
+    CPPUNIT_ASSERT_EQUAL(std::string("{'name':'D::D'}"), std::string(second));
+    vim_clang_free_result(first);
+    vim_clang_free_result(second);
+    CPPUNIT_ASSERT_EQUAL(std::string("{'retain':0}"),
+                         std::string(vim_clang_retain_results("0")));
+}
+
+void deduction_test::test_threads() {
+    auto vim_clang_get_current_function_at =
+        reinterpret_cast<char const* (*)(char const*)>(
+            dlsym(m_handle, "vim_clang_get_current_function_at"));
+    assert(vim_clang_get_current_function_at);
+
+    // Each thread gets its own result buffer.
+    std::string actual[2];
+    std::thread first([&]() {
+        for (int i = 0; i < 10; ++i)
+            actual[0] = vim_clang_get_current_function_at(
+                "qa/data/current-function.cpp:-std=c++1y:10:1");
+    });
+    std::thread second([&]() {
+        for (int i = 0; i < 10; ++i)
+            actual[1] = vim_clang_get_current_function_at(
+                "qa/data/current-function.cpp:-std=c++1y:22:11");
+    });
+    first.join();
+    second.join();
+    CPPUNIT_ASSERT_EQUAL(std::string("{'name':'ns::C::foo'}"), actual[0]);
+    CPPUNIT_ASSERT_EQUAL(std::string("{'name':'D::~D'}"), actual[1]);
+}
+
+void deduction_test::test_json_format() {
+    auto vim_clang_batch = reinterpret_cast<char const* (*)(char const*)>(
+        dlsym(m_handle, "vim_clang_batch"));
+    assert(vim_clang_batch);
+
+    // Double quotes and no trailing commas.
+    std::string expected("[{\"name\":\"ns::C::foo\"},{\"brief\":\"This is "
+                         "foo.\"},{}]");
+    std::string actual(vim_clang_batch(
+        "qa/data/current-function.cpp:-std=c++1y --vim-clang-format=json:"
+        "vim_clang_get_current_function_at:10:1;"
+        "vim_clang_get_comment_at:37:8;vim_clang_no_such_api:1:1"));
+    CPPUNIT_ASSERT_EQUAL(expected, actual);
+}
+
+void deduction_test::test_shutdown() {
+    auto vim_clang_parse_async = reinterpret_cast<char const* (*)(char const*)>(
+        dlsym(m_handle, "vim_clang_parse_async"));
+    assert(vim_clang_parse_async);
+    auto vim_clang_poll = reinterpret_cast<char const* (*)(char const*)>(
+        dlsym(m_handle, "vim_clang_poll"));
+    assert(vim_clang_poll);
+    auto vim_clang_shutdown = reinterpret_cast<char const* (*)(char const*)>(
+        dlsym(m_handle, "vim_clang_shutdown"));
+    assert(vim_clang_shutdown);
+
+    // The library stays loaded when it's closed, like after a libcall().
+    dlclose(m_handle);
+    m_handle = dlopen("lib/libclang-vim.so", RTLD_NOW | RTLD_NOLOAD);
+    CPPUNIT_ASSERT(m_handle);
+
+    std::string ticket(
+        vim_clang_parse_async("qa/data/diagnostics.cpp:-Wunused-variable"));
+    CPPUNIT_ASSERT_EQUAL(std::string("{'pinned':1}"),
+                         std::string(vim_clang_shutdown("")));
+    // Tickets are dropped, but parsing works again.
+    CPPUNIT_ASSERT_EQUAL(std::string("{}"),
+                         std::string(vim_clang_poll(ticket.c_str())));
+    ticket = vim_clang_parse_async("qa/data/diagnostics.cpp:-Wunused-variable");
+    std::string status;
+    for (int i = 0; i < 1000; ++i) {
+        status = vim_clang_poll(ticket.c_str());
+        if (status != "'pending'")
+            break;
+        usleep(10000);
+    }
+    CPPUNIT_ASSERT_EQUAL(std::string("{'status':'ready'}"), status);
+}
+void deduction_test::test_preamble_directory() {
+    auto vim_clang_set_preamble_directory =
+        reinterpret_cast<char const* (*)(char const*)>(
+            dlsym(m_handle, "vim_clang_set_preamble_directory"));
+    assert(vim_clang_set_preamble_directory);
+
+    char temp[] = "/tmp/libclang-vim-XXXXXX";
+    CPPUNIT_ASSERT(mkdtemp(temp));
+    // Neither "parent" nor the quoted name exist yet.
+    std::string const parent = std::string(temp) + "/parent";
+    std::string const directory = parent + "/it's";
+    std::string const actual(
+        vim_clang_set_preamble_directory(directory.c_str()));
+    struct stat status {};
+    bool const created = stat(directory.c_str(), &status) == 0;
+    vim_clang_set_preamble_directory("");
+    rmdir(directory.c_str());
+    rmdir(parent.c_str());
+    rmdir(temp);
+
+    // Older libclang can't store preambles on disk.
+    if (actual == "{}")
+        return;
+
+    CPPUNIT_ASSERT_EQUAL("{'directory':'" + parent + "/it''s'}", actual);
+    CPPUNIT_ASSERT(created);
+}
+
+
 CPPUNIT_TEST_SUITE_REGISTRATION(deduction_test);
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -8,10 +8,20 @@ class tokenizer_test : public CPPUNIT_NS::TestFixture {
     CPPUNIT_TEST_SUITE(tokenizer_test);
     CPPUNIT_TEST(test_tokens);
     CPPUNIT_TEST(test_unsaved_tokens);
+    CPPUNIT_TEST(test_escaped_tokens);
+    CPPUNIT_TEST(test_tokens_delta);
+    CPPUNIT_TEST(test_tokens_in_range);
+    CPPUNIT_TEST(test_annotated_tokens);
+    CPPUNIT_TEST(test_updated_buffer_tokens);
     CPPUNIT_TEST_SUITE_END();
 
     void test_tokens();
     void test_unsaved_tokens();
+    void test_escaped_tokens();
+    void test_tokens_delta();
+    void test_tokens_in_range();
+    void test_annotated_tokens();
+    void test_updated_buffer_tokens();
 
     void* m_handle = nullptr;
 
@@ -63,6 +73,130 @@ void tokenizer_test::test_unsaved_tokens() {
     CPPUNIT_ASSERT(actual != "[]");
 }
 
+void tokenizer_test::test_escaped_tokens() {
+    auto vim_clang_tokens = reinterpret_cast<char const* (*)(char const*)>(
+        dlsym(m_handle, "vim_clang_tokens"));
+    assert(vim_clang_tokens);
+
+    std::string actual(vim_clang_tokens("qa/data/quote.cpp:-std=c++1y"));
+    // The quote inside the literal ended the Vim string early.
+    CPPUNIT_ASSERT(actual.find("{'spell':'\"it''s\"','kind':'literal',") !=
+                   std::string::npos);
+}
+
+void tokenizer_test::test_tokens_delta() {
+    auto vim_clang_tokens_delta =
+        reinterpret_cast<char const* (*)(char const*)>(
+            dlsym(m_handle, "vim_clang_tokens_delta"));
+    assert(vim_clang_tokens_delta);
+
+    std::string actual(
+        vim_clang_tokens_delta("qa/data/unsaved/tokens-delta.cpp:"));
+    CPPUNIT_ASSERT_EQUAL(0, actual.compare(0, 19, "{'full':1,'tokens':"));
+
+    // "b" became "bc" on the second line: its 3 tokens are replaced, the
+    // following ones move by a byte.
+    actual = vim_clang_tokens_delta("qa/data/unsaved/tokens-delta.cpp#qa/data/"
+                                    "unsaved/tokens-delta-unsaved.cpp:");
+    std::string expected_prefix("{'full':0,'first':3,'removed':3,"
+                                "'line_delta':0,'offset_delta':1,'tokens':[");
+    CPPUNIT_ASSERT_EQUAL(
+        0, actual.compare(0, expected_prefix.size(), expected_prefix));
+    CPPUNIT_ASSERT(actual.find("{'spell':'bc','kind':'identifier',") !=
+                   std::string::npos);
+    CPPUNIT_ASSERT(actual.find("'spell':'a'") == std::string::npos);
+}
+
+void tokenizer_test::test_tokens_in_range() {
+    auto vim_clang_tokens_in_range =
+        reinterpret_cast<char const* (*)(char const*)>(
+            dlsym(m_handle, "vim_clang_tokens_in_range"));
+    assert(vim_clang_tokens_in_range);
+
+    // Only "int b;" on the second line.
+    std::string actual(
+        vim_clang_tokens_in_range("qa/data/unsaved/tokens-delta.cpp::2:2"));
+    std::string expected_prefix("[{'spell':'int','kind':'keyword',");
+    CPPUNIT_ASSERT_EQUAL(
+        0, actual.compare(0, expected_prefix.size(), expected_prefix));
+    CPPUNIT_ASSERT(actual.find("'spell':'b'") != std::string::npos);
+    CPPUNIT_ASSERT(actual.find("'spell':'a'") == std::string::npos);
+    CPPUNIT_ASSERT(actual.find("'line':1,") == std::string::npos);
+
+    // The third line starts inside a block comment, which is not lexed as
+    // code.
+    actual = vim_clang_tokens_in_range("qa/data/block-comment.cpp::3:4");
+    expected_prefix = "[{'spell':'/* int b;";
+    CPPUNIT_ASSERT_EQUAL(
+        0, actual.compare(0, expected_prefix.size(), expected_prefix));
+    CPPUNIT_ASSERT(actual.find("'spell':'c'") == std::string::npos);
+    CPPUNIT_ASSERT(actual.find("'spell':'d'") != std::string::npos);
+
+    // The same for a raw string.
+    actual = vim_clang_tokens_in_range("qa/data/raw-string.cpp:-std=c++1y:3:5");
+    expected_prefix = "[{'spell':'R\"x(";
+    CPPUNIT_ASSERT_EQUAL(
+        0, actual.compare(0, expected_prefix.size(), expected_prefix));
+    CPPUNIT_ASSERT(actual.find("'spell':'b'") == std::string::npos);
+    CPPUNIT_ASSERT(actual.find("'spell':'c'") != std::string::npos);
+}
+
+void tokenizer_test::test_annotated_tokens() {
+    auto vim_clang_tokens = reinterpret_cast<char const* (*)(char const*)>(
+        dlsym(m_handle, "vim_clang_tokens"));
+    assert(vim_clang_tokens);
+
+    std::string actual(
+        vim_clang_tokens("qa/data/quote.cpp:--vim-clang-annotate=1"));
+    // The "s" in "const char* s".
+    CPPUNIT_ASSERT(actual.find("'offset':12,'cursor_kind':'VarDecl',") !=
+                   std::string::npos);
+
+    // Not annotated by default.
+    actual = vim_clang_tokens("qa/data/quote.cpp:");
+    CPPUNIT_ASSERT(actual.find("'cursor_kind'") == std::string::npos);
+}
+
+void tokenizer_test::test_updated_buffer_tokens() {
+    using function_type = char const* (*)(char const*);
+    auto vim_clang_tokens =
+        reinterpret_cast<function_type>(dlsym(m_handle, "vim_clang_tokens"));
+    assert(vim_clang_tokens);
+    auto update_buffer = reinterpret_cast<function_type>(
+        dlsym(m_handle, "vim_clang_update_buffer"));
+    assert(update_buffer);
+    auto update_lines = reinterpret_cast<function_type>(
+        dlsym(m_handle, "vim_clang_update_buffer_lines"));
+    assert(update_lines);
+    auto drop_buffer = reinterpret_cast<function_type>(
+        dlsym(m_handle, "vim_clang_drop_buffer"));
+    assert(drop_buffer);
+
+    CPPUNIT_ASSERT_EQUAL(
+        std::string("{'size':9}"),
+        std::string(update_buffer("qa/data/quote.cpp:int one;\n")));
+    // Replace the first line, then insert a line after it.
+    CPPUNIT_ASSERT_EQUAL(
+        std::string("{'size':9}"),
+        std::string(update_lines("qa/data/quote.cpp:1:1:int two;\n")));
+    CPPUNIT_ASSERT_EQUAL(
+        std::string("{'size':20}"),
+        std::string(update_lines("qa/data/quote.cpp:2:1:int three;\n")));
+
+    std::string actual(vim_clang_tokens("qa/data/quote.cpp:-std=c++1y"));
+    CPPUNIT_ASSERT(actual.find("'spell':'one'") == std::string::npos);
+    CPPUNIT_ASSERT(actual.find("'spell':'two'") != std::string::npos);
+    CPPUNIT_ASSERT(actual.find("'spell':'three'") != std::string::npos);
+
+    // The file on disk is used again.
+    drop_buffer("qa/data/quote.cpp");
+    CPPUNIT_ASSERT_EQUAL(
+        std::string("{}"),
+        std::string(update_lines("qa/data/quote.cpp:1:1:int two;\n")));
+    actual = vim_clang_tokens("qa/data/quote.cpp:-std=c++1y");
+    CPPUNIT_ASSERT(actual.find("'spell':'two'") == std::string::npos);
+}
+
 CPPUNIT_TEST_SUITE_REGISTRATION(tokenizer_test);
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */